@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <optional>
@@ -7,12 +8,25 @@
 #include <string>
 #include <thread>
 
+#include "common/aes_crypto.hpp"
+#include "common/codec.hpp"
 #include "common/message.hpp"
 
 namespace quiz::client {
 
 struct ClientEvent {
   Message message;
+  std::uint32_t request_id{0};  // v2 only: id of the request answered
+  // Streamed responses arrive as several events for one request_id: chunks
+  // carry `chunk`, and the one with `end_of_stream` is the final response.
+  bool chunk{false};
+  bool end_of_stream{false};
+};
+
+// A chunked upload in progress; see ClientCore::open_stream.
+struct OutboundStream {
+  std::uint32_t request_id{0};
+  std::uint16_t next_sequence{0};
 };
 
 class ClientCore {
@@ -25,14 +39,34 @@ class ClientCore {
 
   bool send_message(const Message& msg, std::string& error);
 
+  // Chunked upload (v2 only): every chunk is a full request sent under the
+  // stream's request_id, and the server answers once, after the chunk sent
+  // with `last` (or earlier, with an error).
+  OutboundStream open_stream();
+  bool send_chunk(OutboundStream& stream, const Message& msg, bool last, std::string& error);
+
   std::optional<ClientEvent> pop_event();
 
   bool is_connected() const { return connected_; }
+  std::uint8_t protocol_version() const { return header_.version; }
+  Encoding encoding() const { return header_.encoding; }
 
  private:
+  // Asks the server for frame v2 with MessagePack; stays on v1 JSON if it
+  // does not answer in kind.
+  void negotiate();
   void reader_loop();
+  // Encodes and writes one frame; GCM frames are numbered here, in the
+  // order they go out.
+  bool write_message(const Message& msg, const FrameHeader& header, std::string& error);
 
   int fd_{-1};
+  FrameHeader header_;
+  GcmKeys gcm_keys_;  // agreed in negotiate() when header_ has kFrameFlagGcm
+  std::mutex send_mtx_;
+  std::uint64_t send_sequence_{0};  // guarded by send_mtx_
+  std::uint64_t recv_sequence_{0};  // reader thread only
+  std::atomic<std::uint32_t> next_request_id_{1};
   std::atomic<bool> connected_{false};
   std::thread reader_;
 
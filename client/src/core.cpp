@@ -3,12 +3,15 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <cstring>
 #include <iostream>
 
 #include "common/codec.hpp"
+#include "common/compress.hpp"
 
 namespace quiz::client {
 
@@ -41,10 +44,58 @@ bool ClientCore::connect(const std::string& host, uint16_t port) {
     return false;
   }
   connected_.store(true);
+  negotiate();
   reader_ = std::thread(&ClientCore::reader_loop, this);
   return true;
 }
 
+void ClientCore::negotiate() {
+  header_ = FrameHeader{};
+  send_sequence_ = 0;
+  recv_sequence_ = 0;
+  KeyExchange exchange;
+  Message hello;
+  hello.type = MessageType::Request;
+  hello.action = ActionId::Hello;
+  hello.timestamp = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  // MessagePack is smaller and cheaper to parse than JSON text.
+  hello.data = {{"protocol_versions", {kProtocolV1, kProtocolV2}},
+                {"encodings", {"MSGPACK", "JSON"}},
+                {"compression", {"DEFLATE"}},
+                {"dictionary_id", compression_dictionary_id()},
+                {"ciphers", {"AES-256-GCM"}}};
+  if (exchange.ok()) hello.data["key_share"] = exchange.public_key_hex();
+
+  // Don't hang on a server that never answers.
+  timeval timeout{2, 0};
+  ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string error;
+  auto frame = encode_frame(hello, error);
+  std::vector<std::uint8_t> reply;
+  Message resp;
+  if (!frame.empty() && write_frame(fd_, frame, error) && read_frame(fd_, reply, error) &&
+      decode_frame(reply, resp, error) && resp.status == Status::Success &&
+      resp.data.value("protocol_version", 0) == kProtocolV2) {
+    header_.version = kProtocolV2;
+    header_.encoding =
+        encoding_from_string(resp.data.value("encoding", "JSON")).value_or(Encoding::Json);
+    if (resp.data.value("compression", "") == "DEFLATE") {
+      header_.flags = kFrameFlagDeflate | kFrameFlagAcceptDeflate;
+    }
+    // Authenticated frames under keys of this connection's own: tampering
+    // and replays are caught before anything is parsed.
+    if (resp.data.value("cipher", "") == "AES-256-GCM" &&
+        exchange.derive(resp.data.value("key_share", ""), true, gcm_keys_, error)) {
+      header_.flags |= kFrameFlagGcm;
+    }
+  }
+  timeval none{0, 0};
+  ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+}
+
 void ClientCore::disconnect() {
   if (!connected_.exchange(false)) return;
   if (fd_ >= 0) {
@@ -60,24 +111,56 @@ bool ClientCore::send_message(const Message& msg, std::string& error) {
     error = "not connected";
     return false;
   }
-  auto frame = encode_frame(msg, error);
-  if (frame.empty()) return false;
-  if (!write_frame(fd_, frame, error)) return false;
+  FrameHeader header = header_;
+  header.request_id = next_request_id_.fetch_add(1);
+  return write_message(msg, header, error);
+}
+
+bool ClientCore::write_message(const Message& msg, const FrameHeader& header,
+                               std::string& error) {
+  thread_local std::vector<std::uint8_t> frame;
+  std::lock_guard<std::mutex> lock(send_mtx_);
+  const GcmFrameKey gcm{gcm_keys_.send, send_sequence_ + 1};
+  if (!encode_frame_into(msg, header, frame, error, &gcm)) return false;
+  if (header.flags & kFrameFlagGcm) send_sequence_ = gcm.sequence;
+  return write_frame(fd_, frame, error);
+}
+
+OutboundStream ClientCore::open_stream() {
+  return OutboundStream{next_request_id_.fetch_add(1), 0};
+}
+
+bool ClientCore::send_chunk(OutboundStream& stream, const Message& msg, bool last,
+                            std::string& error) {
+  if (!connected_.load()) {
+    error = "not connected";
+    return false;
+  }
+  if (header_.version != kProtocolV2) {
+    error = "streaming needs protocol v2";
+    return false;
+  }
+  FrameHeader header = header_;
+  header.request_id = stream.request_id;
+  header.sequence = stream.next_sequence;
+  header.flags |= kFrameFlagChunk | (last ? kFrameFlagEndOfStream : 0);
+  if (!write_message(msg, header, error)) return false;
+  ++stream.next_sequence;
   return true;
 }
 
 std::optional<ClientEvent> ClientCore::pop_event() {
   std::unique_lock<std::mutex> lock(queue_mtx_);
   if (queue_.empty()) return std::nullopt;
-  auto ev = queue_.front();
+  auto ev = std::move(queue_.front());
   queue_.pop();
   return ev;
 }
 
 void ClientCore::reader_loop() {
+  std::vector<std::uint8_t> frame;  // reused; decoding copies out of it
+  std::string error;
   while (connected_.load()) {
-    std::vector<std::uint8_t> frame;
-    std::string error;
     if (!read_frame(fd_, frame, error)) {
       if (connected_.load()) {
         std::cerr << "[client] read error: " << error << "\n";
@@ -85,13 +168,23 @@ void ClientCore::reader_loop() {
       break;
     }
     Message msg;
-    if (!decode_frame(frame, msg, error)) {
-      std::cerr << "[client] decode error: " << error << "\n";
+    FrameHeader header;
+    // On a GCM connection a frame that does not open, or comes without GCM,
+    // means the stream was tampered with; nothing after it can be trusted.
+    const bool gcm_only = header_.flags & kFrameFlagGcm;
+    const GcmFrameKey gcm{gcm_keys_.recv, recv_sequence_ + 1};
+    const bool ok = decode_frame(frame, msg, header, error, gcm_only ? &gcm : nullptr);
+    if (header.flags & kFrameFlagGcm) ++recv_sequence_;
+    if (!ok || (gcm_only && !(header.flags & kFrameFlagGcm))) {
+      std::cerr << "[client] decode error: "
+                << (ok ? "unauthenticated frame on a GCM connection" : error) << "\n";
+      if (gcm_only) break;
       continue;
     }
     {
       std::lock_guard<std::mutex> lock(queue_mtx_);
-      queue_.push(ClientEvent{msg});
+      queue_.push(ClientEvent{std::move(msg), header.request_id, (header.flags & kFrameFlagChunk) != 0,
+                              (header.flags & kFrameFlagEndOfStream) != 0});
     }
     queue_cv_.notify_one();
   }
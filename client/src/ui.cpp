@@ -28,57 +28,67 @@ void handle_event(ClientState& state, const ClientEvent& ev) {
     state.last_errors = m.error_code + ": " + m.error_message;
     return;
   }
-  if (m.action == "LOGIN") {
-    state.token = m.session_id;
-    state.role = m.data.value("role", "");
-    state.last_errors.clear();
-  } else if (m.action == "LIST_ROOMS") {
-    state.rooms.clear();
-    for (auto& r : m.data["rooms"]) {
-      RoomRow row;
-      row.room_id = r.value("room_id", -1);
-      row.room_code = r.value("room_code", "");
-      row.room_name = r.value("room_name", "");
-      row.status = r.value("status", "");
-      row.duration_seconds = r.value("duration_seconds", 0);
-      state.rooms.push_back(row);
-    }
-    state.last_errors.clear();
-  } else if (m.action == "GET_EXAM_PAPER") {
-    state.exam.exam_id = m.data.value("exam_id", -1);
-    state.exam.room_id = m.data.value("room_id", -1);
-    state.exam.questions.clear();
-    for (auto& q : m.data["questions"]) {
-      Question qu;
-      qu.question_id = q.value("question_id", -1);
-      qu.text = q.value("question_text", "");
-      qu.difficulty = q.value("difficulty", "");
-      qu.topic = q.value("topic", "");
-      for (auto& [key, val] : q["options"].items()) {
-        qu.options.push_back({key, val});
+  switch (m.action.id()) {
+    case ActionId::Login:
+      state.token = m.session_id;
+      state.role = m.data.value("role", "");
+      state.last_errors.clear();
+      break;
+    case ActionId::ListRooms:
+      state.rooms.clear();
+      for (auto& r : m.data["rooms"]) {
+        RoomRow row;
+        row.room_id = r.value("room_id", -1);
+        row.room_code = r.value("room_code", "");
+        row.room_name = r.value("room_name", "");
+        row.status = r.value("status", "");
+        row.duration_seconds = r.value("duration_seconds", 0);
+        state.rooms.push_back(row);
       }
-      state.exam.questions.push_back(qu);
-    }
-    state.last_errors.clear();
-  } else if (m.action == "START_PRACTICE") {
-    state.practice.practice_id = m.data.value("practice_id", -1);
-    state.practice.questions.clear();
-    for (auto& q : m.data["questions"]) {
-      Question qu;
-      qu.question_id = q.value("question_id", -1);
-      qu.text = q.value("question_text", "");
-      qu.difficulty = q.value("difficulty", "");
-      qu.topic = q.value("topic", "");
-      for (auto& [key, val] : q["options"].items()) {
-        qu.options.push_back({key, val});
+      state.last_errors.clear();
+      break;
+    case ActionId::GetExamPaper:
+      state.exam.exam_id = m.data.value("exam_id", -1);
+      state.exam.room_id = m.data.value("room_id", -1);
+      state.exam.questions.clear();
+      for (auto& q : m.data["questions"]) {
+        Question qu;
+        qu.question_id = q.value("question_id", -1);
+        qu.text = q.value("question_text", "");
+        qu.difficulty = q.value("difficulty", "");
+        qu.topic = q.value("topic", "");
+        for (auto& [key, val] : q["options"].items()) {
+          qu.options.push_back({key, val});
+        }
+        state.exam.questions.push_back(qu);
       }
-      state.practice.questions.push_back(qu);
-    }
-    state.last_errors.clear();
-  } else if (m.action == "SUBMIT_EXAM" || m.action == "SUBMIT_PRACTICE" ||
-             m.action == "GET_ROOM_RESULTS" || m.action == "GET_USER_HISTORY") {
-    state.last_results = dump_json(m.data);
-    state.last_errors.clear();
+      state.last_errors.clear();
+      break;
+    case ActionId::StartPractice:
+      state.practice.practice_id = m.data.value("practice_id", -1);
+      state.practice.questions.clear();
+      for (auto& q : m.data["questions"]) {
+        Question qu;
+        qu.question_id = q.value("question_id", -1);
+        qu.text = q.value("question_text", "");
+        qu.difficulty = q.value("difficulty", "");
+        qu.topic = q.value("topic", "");
+        for (auto& [key, val] : q["options"].items()) {
+          qu.options.push_back({key, val});
+        }
+        state.practice.questions.push_back(qu);
+      }
+      state.last_errors.clear();
+      break;
+    case ActionId::SubmitExam:
+    case ActionId::SubmitPractice:
+    case ActionId::GetRoomResults:
+    case ActionId::GetUserHistory:
+      state.last_results = dump_json(m.data);
+      state.last_errors.clear();
+      break;
+    default:
+      break;
   }
 }
 
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace quiz {
+
+// Every action the protocol defines, as (enumerator, wire name).
+#define QUIZ_ACTIONS(X)                         \
+  X(Hello, "HELLO")                             \
+  X(Echo, "ECHO")                               \
+  X(Register, "REGISTER")                       \
+  X(Login, "LOGIN")                             \
+  X(Logout, "LOGOUT")                           \
+  X(CreateRoom, "CREATE_ROOM")                  \
+  X(ListRooms, "LIST_ROOMS")                    \
+  X(JoinRoom, "JOIN_ROOM")                      \
+  X(StartExam, "START_EXAM")                    \
+  X(GetExamPaper, "GET_EXAM_PAPER")             \
+  X(GetTimerStatus, "GET_TIMER_STATUS")         \
+  X(SubmitAnswer, "SUBMIT_ANSWER")              \
+  X(SubmitExam, "SUBMIT_EXAM")                  \
+  X(StartPractice, "START_PRACTICE")            \
+  X(SubmitPractice, "SUBMIT_PRACTICE")          \
+  X(GetRoomResults, "GET_ROOM_RESULTS")         \
+  X(ExportRoomResults, "EXPORT_ROOM_RESULTS")   \
+  X(GetRoomDetails, "GET_ROOM_DETAILS")         \
+  X(DeleteRoom, "DELETE_ROOM")                  \
+  X(FinishRoom, "FINISH_ROOM")                  \
+  X(GetUserHistory, "GET_USER_HISTORY")         \
+  X(ImportQuestions, "IMPORT_QUESTIONS")        \
+  X(GetServerStats, "GET_SERVER_STATS")
+
+// Unknown covers both "no action" and names outside the list above.
+enum class ActionId : std::uint8_t {
+  Unknown,
+#define QUIZ_ACTION_ENUM(id, name) id,
+  QUIZ_ACTIONS(QUIZ_ACTION_ENUM)
+#undef QUIZ_ACTION_ENUM
+};
+
+inline constexpr std::size_t kActionCount =
+    static_cast<std::size_t>(ActionId::GetServerStats) + 1;
+
+// Wire name of a known action; empty for Unknown.
+std::string_view to_string(ActionId id);
+// Unknown when `name` is not a protocol action.
+ActionId action_from_string(std::string_view name);
+
+// The action of a Message. Protocol actions are interned when the message is
+// built or decoded, so routing and comparing them is an integer operation and
+// copying them never allocates; only extension actions keep their text.
+class Action {
+ public:
+  Action() = default;
+  Action(ActionId id) : id_(id) {}
+  Action(std::string_view name) : id_(action_from_string(name)) {
+    if (id_ == ActionId::Unknown) name_ = name;
+  }
+  Action(const char* name) : Action(std::string_view(name)) {}
+  Action(const std::string& name) : Action(std::string_view(name)) {}
+
+  ActionId id() const { return id_; }
+  bool known() const { return id_ != ActionId::Unknown; }
+  bool empty() const { return !known() && name_.empty(); }
+  std::string_view str() const { return known() ? to_string(id_) : std::string_view(name_); }
+
+  friend bool operator==(const Action& a, const Action& b) {
+    return a.id_ == b.id_ && a.name_ == b.name_;
+  }
+  friend bool operator==(const Action& a, ActionId id) { return a.id_ == id; }
+
+ private:
+  ActionId id_{ActionId::Unknown};
+  std::string name_;  // only for unknown actions
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Action& action) {
+  return os << action.str();
+}
+
+}  // namespace quiz
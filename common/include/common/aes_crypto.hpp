@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+struct evp_pkey_st;
+
 namespace quiz {
 
 // AES-256-CBC encryption key (32 bytes) - SHARED with Node.js gateway
@@ -15,6 +17,9 @@ extern const std::uint8_t AES_KEY[32];
 // DO NOT use in production - this is for educational purposes only!
 extern const std::uint8_t AES_IV[16];
 
+// All of these run on a per-thread cipher context keyed once, so a call
+// costs the AES work and, for the vector-returning forms, the result.
+
 // Encrypt plaintext using AES-256-CBC
 // Returns encrypted data, or empty vector on error (error string filled)
 std::vector<std::uint8_t> encrypt_aes_cbc(
@@ -23,6 +28,14 @@ std::vector<std::uint8_t> encrypt_aes_cbc(
     std::string& error
 );
 
+// Encrypt buffer[offset, end) in place using AES-256-CBC; the buffer grows
+// by the PKCS#7 padding. Returns false on error (error string filled)
+bool encrypt_aes_cbc_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    std::string& error
+);
+
 // Decrypt ciphertext using AES-256-CBC
 // Returns decrypted data, or empty vector on error (error string filled)
 std::vector<std::uint8_t> decrypt_aes_cbc(
@@ -31,4 +44,89 @@ std::vector<std::uint8_t> decrypt_aes_cbc(
     std::string& error
 );
 
+// Decrypt into `out`, which is overwritten; a buffer reused across calls
+// stops allocating once it has grown. Returns false on error (error string filled)
+bool decrypt_aes_cbc_into(
+    const std::uint8_t* ciphertext,
+    std::size_t ciphertext_len,
+    std::vector<std::uint8_t>& out,
+    std::string& error
+);
+
+// Decrypt buffer[offset, end) in place; the buffer shrinks by the padding.
+// Returns false on error (error string filled), leaving the bytes unspecified
+bool decrypt_aes_cbc_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    std::string& error
+);
+
+// AES-256-GCM, negotiated per connection on protocol v2. A sealed message
+// is nonce | ciphertext | tag; the ciphertext is as long as the plaintext.
+// Unlike CBC it never uses AES_KEY: every connection agrees on keys of its
+// own in HELLO, one per direction.
+constexpr std::size_t kGcmNonceBytes = 12;
+constexpr std::size_t kGcmTagBytes = 16;
+constexpr std::size_t kGcmKeyBytes = 32;
+
+struct GcmKeys {
+  std::uint8_t send[kGcmKeyBytes]{};
+  std::uint8_t recv[kGcmKeyBytes]{};
+};
+
+// One side of the HELLO key agreement: an ephemeral X25519 key pair. Each
+// side sends its public key as hex; both then derive the same two keys with
+// HKDF-SHA256 over the shared secret. Nothing here authenticates the server,
+// so an active man in the middle can still agree on keys with each side;
+// connections that need that guarantee use kernel TLS.
+class KeyExchange {
+ public:
+  KeyExchange();  // ok() is false if no key pair could be generated
+  ~KeyExchange();
+  KeyExchange(const KeyExchange&) = delete;
+  KeyExchange& operator=(const KeyExchange&) = delete;
+
+  bool ok() const { return key_ != nullptr; }
+  const std::string& public_key_hex() const { return public_hex_; }
+
+  // Keys shared with the peer whose public key is `peer_hex`; `client` picks
+  // which of the two this side sends with. Returns false on error (error
+  // string filled)
+  bool derive(const std::string& peer_hex, bool client, GcmKeys& out,
+              std::string& error) const;
+
+ private:
+  evp_pkey_st* key_{nullptr};
+  std::string public_hex_;
+};
+
+// Encrypt buffer[offset, end) in place using AES-256-GCM under `key`. The
+// nonce written to buffer[offset - kGcmNonceBytes, offset) is `sequence`,
+// which must never repeat under one key; the tag is appended and `aad` is
+// authenticated but not encrypted. Returns false on error (error string filled)
+bool encrypt_aes_gcm_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    const std::uint8_t* key,
+    std::uint64_t sequence,
+    const std::uint8_t* aad,
+    std::size_t aad_len,
+    std::string& error
+);
+
+// Decrypt a sealed message into `out`, which is overwritten. Returns false
+// if its nonce is not `sequence` or the tag does not verify against `key`
+// and `aad` (error string filled); `out` is then empty, so nothing
+// unauthenticated is ever handed on
+bool decrypt_aes_gcm_into(
+    const std::uint8_t* sealed,
+    std::size_t sealed_len,
+    const std::uint8_t* key,
+    std::uint64_t sequence,
+    const std::uint8_t* aad,
+    std::size_t aad_len,
+    std::vector<std::uint8_t>& out,
+    std::string& error
+);
+
 }  // namespace quiz
@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -12,6 +13,77 @@ namespace quiz {
 constexpr std::size_t kFramePrefixBytes = 4;
 constexpr std::size_t kMaxPayloadSize = 1024 * 1024;  // 1 MiB safeguard.
 
+// Wire protocol versions. A v1 frame is length + ciphertext. A v2 frame puts
+// a plaintext FrameHeader between the two; the length covers both. Because
+// AES-CBC ciphertext is always a multiple of 16 bytes and the header is not,
+// the two layouts cannot be confused.
+constexpr std::uint8_t kProtocolV1 = 1;
+constexpr std::uint8_t kProtocolV2 = 2;
+constexpr std::uint16_t kFrameMagic = 0x515A;  // "QZ"
+constexpr std::size_t kFrameHeaderBytes = 12;
+static_assert(kFrameHeaderBytes % 16 != 0, "v2 header must not look like ciphertext");
+
+// Serialization of the envelope inside the ciphertext. Binary encodings are
+// v2 only and negotiated through HELLO; v1 frames are always JSON.
+enum class Encoding : std::uint8_t { Json = 0, MsgPack = 1, Cbor = 2 };
+
+std::string to_string(Encoding encoding);  // "JSON", "MSGPACK", "CBOR"
+std::optional<Encoding> encoding_from_string(const std::string& value);
+
+// v2 frame flags. A deflated frame carries the serialized envelope compressed
+// with the protocol dictionary (see common/compress.hpp). Senders set
+// kFrameFlagAcceptDeflate to say replies may be deflated.
+constexpr std::uint8_t kFrameFlagDeflate = 0x01;
+constexpr std::uint8_t kFrameFlagAcceptDeflate = 0x02;
+// Envelopes smaller than this are sent as is; compression would not pay.
+constexpr std::size_t kCompressThreshold = 512;
+
+// Chunked streams carry payloads too large for one frame. A stream is a run
+// of frames sharing one request_id, each flagged kFrameFlagChunk and
+// numbered from 0 in `sequence`; the last also has kFrameFlagEndOfStream.
+// Every chunk is a complete envelope whose `data` holds one piece (a batch
+// of rows, say), so either side can process it as it arrives.
+constexpr std::uint8_t kFrameFlagChunk = 0x04;
+constexpr std::uint8_t kFrameFlagEndOfStream = 0x08;
+
+// The payload after the header is sealed with AES-256-GCM instead of CBC:
+// nonce, ciphertext, tag (see aes_crypto.hpp), with the header as
+// associated data. The envelope is padded so the v2 length rule above still
+// holds. Negotiated through HELLO; a frame that fails the tag check is
+// rejected before any parsing.
+constexpr std::uint8_t kFrameFlagGcm = 0x10;
+// The key a GCM frame is sealed or opened with and its number: each side of
+// a connection numbers the GCM frames it sends 1, 2, ... and the number is
+// the nonce. A receiver passes the number it expects next, so a replayed or
+// reordered frame is rejected like a forged one.
+struct GcmFrameKey {
+  const std::uint8_t* key{nullptr};  // kGcmKeyBytes, see aes_crypto.hpp
+  std::uint64_t sequence{0};
+};
+// The payload after the header is the envelope itself, padded the same way.
+// Only for connections the transport already encrypts (kernel TLS), where
+// HELLO may negotiate it; other servers reject such frames.
+constexpr std::uint8_t kFrameFlagPlaintext = 0x20;
+
+// Higher is more urgent. Low priority work may be shed under load.
+enum class Priority : std::uint8_t { Low = 0, Normal = 1, High = 2 };
+
+// v2 layout: magic(2) version(1) flags(1) encoding(1) priority(1)
+// sequence(2) request_id(4), multi-byte fields big-endian.
+struct FrameHeader {
+  std::uint8_t version{kProtocolV1};
+  std::uint8_t flags{0};
+  Encoding encoding{Encoding::Json};
+  Priority priority{Priority::Normal};
+  std::uint16_t sequence{0};  // chunk number within a stream, else 0
+  std::uint32_t request_id{0};
+};
+
+// Header for the reply to a request: same version, encoding, cipher (or
+// plaintext), priority and request_id, deflated if the requester accepts
+// that, and not part of a stream.
+FrameHeader reply_header(const FrameHeader& request);
+
 // Low-level helpers for POSIX-style file descriptors.
 // Returns total bytes read (0 means EOF) or -1 on unrecoverable error.
 ssize_t read_exact(int fd, void* buffer, std::size_t length);
@@ -21,9 +93,38 @@ ssize_t write_exact(int fd, const void* buffer, std::size_t length);
 // Encode a Message into a length-prefixed frame.
 // On success, returns frame (prefix + JSON). On failure, frame is empty and error is filled.
 std::vector<std::uint8_t> encode_frame(const Message& msg, std::string& error);
+// Same, framed as `header.version` and serialized as `header.encoding` (v1
+// ignores the other header fields). With kFrameFlagDeflate set, envelopes of
+// at least kCompressThreshold bytes are compressed when that makes them
+// smaller; otherwise the flag is cleared on the wire.
+std::vector<std::uint8_t> encode_frame(const Message& msg, const FrameHeader& header,
+                                       std::string& error);
+// Same, building the frame in `frame`, which is overwritten. The envelope is
+// serialized and encrypted in place, so a buffer reused across calls makes
+// encoding allocation-free once it has grown. Returns false on failure.
+// GCM frames need `gcm`.
+bool encode_frame_into(const Message& msg, const FrameHeader& header,
+                       std::vector<std::uint8_t>& frame, std::string& error,
+                       const GcmFrameKey* gcm = nullptr);
 
 // Decode a full frame (prefix + payload). Returns true on success, false otherwise.
 bool decode_frame(const std::vector<std::uint8_t>& frame, Message& out, std::string& error);
+// Same, also reporting the frame header (version 1 for v1 frames). GCM
+// frames need `gcm`.
+bool decode_frame(const std::vector<std::uint8_t>& frame, Message& out, FrameHeader& header,
+                  std::string& error, const GcmFrameKey* gcm = nullptr);
+
+// Like decode_frame, but for JSON envelopes only the top-level fields are
+// parsed; `data` is left as raw text in `out.raw_data` until
+// materialize_data. Binary encodings are decoded fully.
+bool decode_frame_envelope(const std::vector<std::uint8_t>& frame, Message& out,
+                           FrameHeader& header, std::string& error,
+                           const GcmFrameKey* gcm = nullptr);
+
+// Reads the header of a full frame without decrypting it. v1 frames yield a
+// default header. Returns false for a malformed or unsupported v2 header.
+bool peek_frame_header(const std::uint8_t* frame, std::size_t size, FrameHeader& out,
+                       std::string& error);
 
 // Read a frame from fd into `frame` (prefix + payload). Returns true on success, false on EOF/error.
 bool read_frame(int fd, std::vector<std::uint8_t>& frame, std::string& error);
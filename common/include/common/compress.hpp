@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace quiz {
+
+// zlib compression primed with the protocol dictionary
+// (common/src/deflate_dictionary.inc, built by scripts/train_dict). Both
+// sides must hold the same dictionary; its id is exchanged in HELLO.
+std::uint32_t compression_dictionary_id();
+
+// Appends the compressed form of `data` to `out`. Returns false on error.
+bool deflate_payload(const std::uint8_t* data, std::size_t len, std::vector<std::uint8_t>& out,
+                     std::string& error);
+
+// Replaces `out` with the decompressed data. Fails rather than produce more
+// than `max_len` bytes.
+bool inflate_payload(const std::uint8_t* data, std::size_t len, std::size_t max_len,
+                     std::vector<std::uint8_t>& out, std::string& error);
+
+}  // namespace quiz
@@ -4,10 +4,18 @@
 
 namespace quiz {
 
-// Simple non-cryptographic hash for demo purposes only.
-// DO NOT USE in production.
-std::string hash_password(const std::string& password, const std::string& salt = "quiz_salt");
+// Password hashes are self-describing strings:
+//   $scrypt$<log2 N>$<r>$<p>$<salt hex>$<key hex>
+// scrypt is memory-hard (128 * r * N bytes per hash, 16 MiB at the current
+// cost) and every password gets its own random salt. Hashes without a "$"
+// prefix are the legacy salted std::hash values; they still verify, so old
+// accounts keep working until their next login upgrades them.
+std::string hash_password(const std::string& password);
 
-bool verify_password(const std::string& password, const std::string& stored_hash, const std::string& salt = "quiz_salt");
+// Constant-time check of `password` against any supported format. Sets
+// *needs_rehash when the password matched a legacy hash or older cost
+// parameters and should be stored again with hash_password.
+bool verify_password(const std::string& password, const std::string& stored_hash,
+                     bool* needs_rehash = nullptr);
 
 }  // namespace quiz
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "common/codec.hpp"
+
+namespace quiz {
+
+// Streams a value in one of the wire encodings straight into a byte buffer,
+// without building a JSON DOM. Output is byte for byte what serializing the
+// equivalent nlohmann::json would give, provided keys are written in sorted
+// order as nlohmann keeps them.
+//
+// Binary encodings put the element count in a container's header, so
+// begin_object/begin_array take it up front and exactly that many fields or
+// elements must follow. Errors (a string that is not UTF-8, nesting too
+// deep) are sticky: later calls are ignored and ok() turns false.
+class DataWriter {
+ public:
+  DataWriter(std::vector<std::uint8_t>& out, Encoding encoding);
+
+  void begin_object(std::size_t fields);
+  void end_object();
+  void begin_array(std::size_t size);
+  void end_array();
+  void key(std::string_view name);
+
+  void string(std::string_view value);
+  void integer(std::int64_t value);
+  void number(std::uint64_t value);
+  void real(double value);
+  void boolean(bool value);
+  void null();
+  void value(const nlohmann::json& j);
+  // A complete JSON value held as text, e.g. a column storing JSON. Copied
+  // verbatim for JSON, so it must be well formed; parsed otherwise.
+  void raw_json(std::string_view text);
+
+  bool ok() const { return error_.empty(); }
+  const std::string& error() const { return error_; }
+
+ private:
+  static constexpr int kMaxDepth = 64;
+
+  bool before_value();
+  void open(std::size_t size, bool map);
+  void close(char bracket);
+  void container(std::size_t size, bool map);
+  void scalar(const nlohmann::json& j);
+  void write_string(std::string_view value);
+  void be(std::uint64_t value, int bytes);
+  void cbor_head(std::uint8_t major, std::uint64_t value);
+  void json_string(std::string_view value);
+  void fail(const char* what);
+
+  std::vector<std::uint8_t>& out_;
+  Encoding encoding_;
+  int depth_{0};
+  // Bit d - 1 describes the container at depth d, for JSON separators.
+  std::uint64_t in_array_{0};
+  std::uint64_t has_element_{0};
+  std::string error_;
+};
+
+}  // namespace quiz
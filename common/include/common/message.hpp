@@ -1,22 +1,38 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <optional>
 #include <string>
 
 #include <nlohmann/json.hpp>
 
+#include "common/action.hpp"
+
 namespace quiz {
 
+class DataWriter;
+
 enum class MessageType { Request, Response, Notification };
 enum class Status { None, Success, Error };
 
 struct Message {
   MessageType type{MessageType::Request};
-  std::string action;
+  Action action;
   std::uint64_t timestamp{0};
   std::string session_id;
-  nlohmann::json data{nlohmann::json::object()};
+  // Optional time budget in milliseconds, counted from when the server
+  // receives the request. 0 means no deadline.
+  std::uint32_t deadline_ms{0};
+  nlohmann::json data = nlohmann::json::object();
+  // Unparsed JSON object text standing in for `data` when non-empty; see
+  // decode_frame_envelope and materialize_data.
+  std::string raw_data;
+  // When set, writes `data` (one object) straight into the encoded frame in
+  // place of `data` and `raw_data`, for large replies built from rows rather
+  // than JSON. It runs when the message is encoded, possibly on another
+  // thread, so it must own what it writes. See common/data_writer.hpp.
+  std::function<void(DataWriter&)> write_data;
   Status status{Status::None};
   std::string error_code;
   std::string error_message;
@@ -32,4 +48,7 @@ std::optional<Status> status_from_string(const std::string& value);
 std::optional<Message> message_from_json(const nlohmann::json& j, std::string& error);
 nlohmann::json message_to_json(const Message& msg);
 
+// Parses a pending `raw_data` into `data`. No-op when nothing is pending.
+bool materialize_data(Message& msg, std::string& error);
+
 }  // namespace quiz
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace quiz {
+
+// UTF-8 validation kernels. All of them enforce RFC 3629: no overlong forms,
+// no UTF-16 surrogates (U+D800..U+DFFF), nothing above U+10FFFF.
+enum class Utf8Impl { Scalar, Sse4, Avx2 };
+
+std::string to_string(Utf8Impl impl);  // "scalar", "sse4", "avx2"
+
+// Validates with the fastest kernel this CPU supports (picked once).
+bool is_valid_utf8(const void* data, std::size_t len);
+bool is_valid_utf8(const std::string& s);
+
+// Kernel used by is_valid_utf8.
+Utf8Impl active_utf8_impl();
+
+// For tests and benchmarks: whether `impl` was compiled in and the CPU runs
+// it, and validation with that specific kernel (which must be available).
+bool utf8_impl_available(Utf8Impl impl);
+bool is_valid_utf8_with(Utf8Impl impl, const void* data, std::size_t len);
+
+}  // namespace quiz
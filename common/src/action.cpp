@@ -0,0 +1,32 @@
+#include "common/action.hpp"
+
+#include <array>
+
+namespace quiz {
+namespace {
+
+constexpr std::array<std::string_view, kActionCount> kActionNames = {
+    "",
+#define QUIZ_ACTION_NAME(id, name) name,
+    QUIZ_ACTIONS(QUIZ_ACTION_NAME)
+#undef QUIZ_ACTION_NAME
+};
+
+}  // namespace
+
+std::string_view to_string(ActionId id) {
+  const auto index = static_cast<std::size_t>(id);
+  return index < kActionNames.size() ? kActionNames[index] : std::string_view();
+}
+
+ActionId action_from_string(std::string_view name) {
+  // Few enough names that a scan (length compared first) beats hashing.
+  for (std::size_t i = 1; i < kActionNames.size(); ++i) {
+    if (kActionNames[i] == name) {
+      return static_cast<ActionId>(i);
+    }
+  }
+  return ActionId::Unknown;
+}
+
+}  // namespace quiz
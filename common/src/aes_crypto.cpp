@@ -1,7 +1,12 @@
 #include "common/aes_crypto.hpp"
 
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
+#include <openssl/kdf.h>
+#include <openssl/params.h>
+#include <openssl/rand.h>
 #include <cstring>
 
 namespace quiz {
@@ -21,102 +26,373 @@ const std::uint8_t AES_IV[16] = {
     0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff,0x01
 };
 
-std::vector<std::uint8_t> encrypt_aes_cbc(
-    const std::uint8_t* plaintext,
-    std::size_t plaintext_len,
-    std::string& error
-) {
-    // Create EVP cipher context
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-        error = "Failed to create EVP cipher context";
-        return {};
+namespace {
+
+// One keyed context per thread, mode and direction. The key schedule is
+// computed once; each message only resets the IV, so no context is created,
+// no cipher is fetched and nothing is allocated per call.
+struct CipherContext {
+    EVP_CIPHER_CTX* ctx{nullptr};
+    bool ok{false};
+    CipherContext(const EVP_CIPHER* cipher, int encrypt, const std::uint8_t* key = AES_KEY)
+        : ctx(EVP_CIPHER_CTX_new()) {
+        ok = ctx && EVP_CipherInit_ex(ctx, cipher, nullptr, key, nullptr, encrypt) == 1;
     }
+    ~CipherContext() { EVP_CIPHER_CTX_free(ctx); }
 
-    // Calculate maximum output size: plaintext + block_size for padding
-    // AES block size is 16 bytes
-    int block_size = EVP_CIPHER_block_size(EVP_aes_256_cbc());
-    std::size_t max_output_len = plaintext_len + block_size;
-    std::vector<std::uint8_t> ciphertext(max_output_len);
+    // Rewinds to the start of a message; also clears state left by a failed one.
+    bool reset(const std::uint8_t* iv) {
+        return ok && EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, iv, -1) == 1;
+    }
+};
 
-    int len1 = 0, len2 = 0;
+// GCM keys belong to connections, so the context is re-keyed whenever a
+// message's key differs from the previous one on the thread; a run of frames
+// of one connection computes the key schedule once.
+struct GcmContext {
+    CipherContext c;
+    std::uint8_t key[kGcmKeyBytes]{};
+    bool keyed{false};
+    explicit GcmContext(int encrypt) : c(EVP_aes_256_gcm(), encrypt, nullptr) {}
 
-    // Initialize encryption with AES-256-CBC
-    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, AES_KEY, AES_IV) != 1) {
-        error = "EVP_EncryptInit_ex failed";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+    bool reset(const std::uint8_t* new_key, const std::uint8_t* iv) {
+        if (!c.ok) return false;
+        if (keyed && CRYPTO_memcmp(key, new_key, kGcmKeyBytes) == 0) return c.reset(iv);
+        keyed = EVP_CipherInit_ex(c.ctx, nullptr, nullptr, new_key, iv, -1) == 1;
+        if (keyed) std::memcpy(key, new_key, kGcmKeyBytes);
+        return keyed;
     }
+};
+
+// The nonce is the message's sequence number, big-endian in its low 64 bits.
+// Each key seals one direction of one connection, whose numbers never repeat.
+void nonce_for(std::uint64_t sequence, std::uint8_t* out) {
+    std::memset(out, 0, kGcmNonceBytes);
+    for (int i = 0; i < 8; ++i) {
+        out[kGcmNonceBytes - 1 - i] = static_cast<std::uint8_t>(sequence >> (8 * i));
+    }
+}
+
+constexpr std::size_t kKeyShareBytes = 32;
+
+std::string to_hex(const std::uint8_t* data, std::size_t len) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(len * 2);
+    for (std::size_t i = 0; i < len; ++i) {
+        out.push_back(kHex[data[i] >> 4]);
+        out.push_back(kHex[data[i] & 0xF]);
+    }
+    return out;
+}
+
+bool from_hex(const std::string& text, std::uint8_t* out, std::size_t len) {
+    if (text.size() != len * 2) return false;
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    for (std::size_t i = 0; i < len; ++i) {
+        const int hi = nibble(text[2 * i]);
+        const int lo = nibble(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = static_cast<std::uint8_t>(hi << 4 | lo);
+    }
+    return true;
+}
 
-    // Encrypt the data
-    if (EVP_EncryptUpdate(ctx, ciphertext.data(), &len1, plaintext, static_cast<int>(plaintext_len)) != 1) {
-        error = "EVP_EncryptUpdate failed";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+EVP_CIPHER_CTX* encryptor() {
+    thread_local CipherContext c(EVP_aes_256_cbc(), 1);
+    return c.reset(AES_IV) ? c.ctx : nullptr;
+}
+
+EVP_CIPHER_CTX* decryptor() {
+    thread_local CipherContext c(EVP_aes_256_cbc(), 0);
+    return c.reset(AES_IV) ? c.ctx : nullptr;
+}
+
+constexpr std::size_t kBlockSize = 16;
+
+// Encrypts `len` bytes at `in` to `out`, which has room for len + one block
+// and is either `in` itself or disjoint from it. Returns the ciphertext
+// length, or 0 on error.
+std::size_t encrypt_to(const std::uint8_t* in, std::size_t len, std::uint8_t* out,
+                       std::string& error) {
+    EVP_CIPHER_CTX* ctx = encryptor();
+    if (!ctx) {
+        error = "Failed to set up AES-256-CBC context";
+        return 0;
     }
+    int len1 = 0, len2 = 0;
+    if (EVP_EncryptUpdate(ctx, out, &len1, in, static_cast<int>(len)) != 1 ||
+        EVP_EncryptFinal_ex(ctx, out + len1, &len2) != 1) {
+        error = "AES-256-CBC encryption failed";
+        return 0;
+    }
+    return static_cast<std::size_t>(len1 + len2);
+}
 
-    // Finalize encryption (adds PKCS#7 padding)
-    if (EVP_EncryptFinal_ex(ctx, ciphertext.data() + len1, &len2) != 1) {
-        error = "EVP_EncryptFinal_ex failed";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+// Decrypts `len` bytes at `in` to `out` under the same aliasing rule. The
+// plaintext is never longer than the ciphertext. Returns false on error,
+// including a wrong padding.
+bool decrypt_to(const std::uint8_t* in, std::size_t len, std::uint8_t* out,
+                std::size_t& out_len, std::string& error) {
+    EVP_CIPHER_CTX* ctx = decryptor();
+    if (!ctx) {
+        error = "Failed to set up AES-256-CBC context";
+        return false;
     }
+    int len1 = 0, len2 = 0;
+    if (EVP_DecryptUpdate(ctx, out, &len1, in, static_cast<int>(len)) != 1) {
+        error = "EVP_DecryptUpdate failed";
+        return false;
+    }
+    if (EVP_DecryptFinal_ex(ctx, out + len1, &len2) != 1) {
+        // Decryption failure - likely wrong key, corrupted data, or invalid padding
+        error = "EVP_DecryptFinal_ex failed - invalid padding or wrong key";
+        return false;
+    }
+    out_len = static_cast<std::size_t>(len1 + len2);
+    return true;
+}
 
-    // Clean up context
-    EVP_CIPHER_CTX_free(ctx);
+}  // namespace
 
-    // Resize vector to actual encrypted length
-    ciphertext.resize(len1 + len2);
+std::vector<std::uint8_t> encrypt_aes_cbc(
+    const std::uint8_t* plaintext,
+    std::size_t plaintext_len,
+    std::string& error
+) {
+    // PKCS#7 padding adds at most one block
+    std::vector<std::uint8_t> ciphertext(plaintext_len + kBlockSize);
+    const std::size_t len = encrypt_to(plaintext, plaintext_len, ciphertext.data(), error);
+    if (len == 0) return {};
+    ciphertext.resize(len);
     return ciphertext;
 }
 
+bool encrypt_aes_cbc_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    std::string& error
+) {
+    // Room for the padding block; CBC may write its output over its input
+    // as long as both start at the same address.
+    const std::size_t plaintext_len = buffer.size() - offset;
+    buffer.resize(buffer.size() + kBlockSize);
+    std::uint8_t* data = buffer.data() + offset;
+    const std::size_t len = encrypt_to(data, plaintext_len, data, error);
+    if (len == 0) {
+        buffer.resize(offset + plaintext_len);
+        return false;
+    }
+    buffer.resize(offset + len);
+    return true;
+}
+
 std::vector<std::uint8_t> decrypt_aes_cbc(
     const std::uint8_t* ciphertext,
     std::size_t ciphertext_len,
     std::string& error
 ) {
-    // Create EVP cipher context
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-        error = "Failed to create EVP cipher context";
-        return {};
-    }
+    std::vector<std::uint8_t> plaintext;
+    if (!decrypt_aes_cbc_into(ciphertext, ciphertext_len, plaintext, error)) return {};
+    return plaintext;
+}
 
-    // Allocate buffer for decrypted data
-    // Maximum size is ciphertext length + block size
-    int block_size = EVP_CIPHER_block_size(EVP_aes_256_cbc());
-    std::vector<std::uint8_t> plaintext(ciphertext_len + block_size);
+bool decrypt_aes_cbc_into(
+    const std::uint8_t* ciphertext,
+    std::size_t ciphertext_len,
+    std::vector<std::uint8_t>& out,
+    std::string& error
+) {
+    // OpenSSL may stage up to a block more than it finally reports
+    out.resize(ciphertext_len + kBlockSize);
+    std::size_t len = 0;
+    if (!decrypt_to(ciphertext, ciphertext_len, out.data(), len, error)) {
+        out.clear();
+        return false;
+    }
+    out.resize(len);
+    return true;
+}
 
-    int len1 = 0, len2 = 0;
+bool decrypt_aes_cbc_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    std::string& error
+) {
+    std::uint8_t* data = buffer.data() + offset;
+    std::size_t len = 0;
+    if (!decrypt_to(data, buffer.size() - offset, data, len, error)) return false;
+    buffer.resize(offset + len);
+    return true;
+}
 
-    // Initialize decryption with AES-256-CBC
-    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, AES_KEY, AES_IV) != 1) {
-        error = "EVP_DecryptInit_ex failed";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+bool encrypt_aes_gcm_in_place(
+    std::vector<std::uint8_t>& buffer,
+    std::size_t offset,
+    const std::uint8_t* key,
+    std::uint64_t sequence,
+    const std::uint8_t* aad,
+    std::size_t aad_len,
+    std::string& error
+) {
+    thread_local GcmContext g(1);
+    CipherContext& c = g.c;
+    if (offset < kGcmNonceBytes) {
+        error = "no room for the GCM nonce";
+        return false;
+    }
+    std::uint8_t* nonce = buffer.data() + offset - kGcmNonceBytes;
+    nonce_for(sequence, nonce);
+    if (!g.reset(key, nonce)) {
+        error = "Failed to set up AES-256-GCM context";
+        return false;
+    }
+    const std::size_t len = buffer.size() - offset;
+    buffer.resize(buffer.size() + kGcmTagBytes);
+    std::uint8_t* data = buffer.data() + offset;
+    int out_len = 0, final_len = 0;
+    if ((aad_len > 0 &&
+         EVP_EncryptUpdate(c.ctx, nullptr, &out_len, aad, static_cast<int>(aad_len)) != 1) ||
+        EVP_EncryptUpdate(c.ctx, data, &out_len, data, static_cast<int>(len)) != 1 ||
+        EVP_EncryptFinal_ex(c.ctx, data + out_len, &final_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c.ctx, EVP_CTRL_GCM_GET_TAG, static_cast<int>(kGcmTagBytes),
+                            data + len) != 1) {
+        error = "AES-256-GCM encryption failed";
+        buffer.resize(offset + len);
+        return false;
     }
+    return true;
+}
 
-    // Decrypt the data
-    if (EVP_DecryptUpdate(ctx, plaintext.data(), &len1, ciphertext, static_cast<int>(ciphertext_len)) != 1) {
-        error = "EVP_DecryptUpdate failed";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+bool decrypt_aes_gcm_into(
+    const std::uint8_t* sealed,
+    std::size_t sealed_len,
+    const std::uint8_t* key,
+    std::uint64_t sequence,
+    const std::uint8_t* aad,
+    std::size_t aad_len,
+    std::vector<std::uint8_t>& out,
+    std::string& error
+) {
+    thread_local GcmContext g(0);
+    CipherContext& c = g.c;
+    out.clear();
+    if (sealed_len < kGcmNonceBytes + kGcmTagBytes) {
+        error = "sealed message too short";
+        return false;
+    }
+    // A replayed or reordered message is authentic, just not the one the
+    // receiver expects next, so its number is checked before the tag.
+    std::uint8_t expected[kGcmNonceBytes];
+    nonce_for(sequence, expected);
+    if (std::memcmp(expected, sealed, kGcmNonceBytes) != 0) {
+        error = "unexpected sequence number - frame replayed or out of order";
+        return false;
+    }
+    if (!g.reset(key, sealed)) {
+        error = "Failed to set up AES-256-GCM context";
+        return false;
+    }
+    const std::size_t len = sealed_len - kGcmNonceBytes - kGcmTagBytes;
+    const std::uint8_t* ciphertext = sealed + kGcmNonceBytes;
+    // OpenSSL only reads the expected tag, but its API takes a non-const pointer.
+    auto* tag = const_cast<std::uint8_t*>(ciphertext + len);
+    out.resize(len);
+    int out_len = 0, final_len = 0;
+    if ((aad_len > 0 &&
+         EVP_DecryptUpdate(c.ctx, nullptr, &out_len, aad, static_cast<int>(aad_len)) != 1) ||
+        EVP_DecryptUpdate(c.ctx, out.data(), &out_len, ciphertext, static_cast<int>(len)) != 1 ||
+        EVP_CIPHER_CTX_ctrl(c.ctx, EVP_CTRL_GCM_SET_TAG, static_cast<int>(kGcmTagBytes), tag) != 1) {
+        error = "AES-256-GCM decryption failed";
+        out.clear();
+        return false;
+    }
+    if (EVP_DecryptFinal_ex(c.ctx, out.data() + out_len, &final_len) != 1) {
+        error = "authentication failed - frame tampered or wrong key";
+        out.clear();
+        return false;
     }
+    return true;
+}
 
-    // Finalize decryption (validates and removes PKCS#7 padding)
-    if (EVP_DecryptFinal_ex(ctx, plaintext.data() + len1, &len2) != 1) {
-        // Decryption failure - likely wrong key, corrupted data, or invalid padding
-        error = "EVP_DecryptFinal_ex failed - invalid padding or wrong key";
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+KeyExchange::KeyExchange() {
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+    EVP_PKEY* key = nullptr;
+    std::uint8_t pub[kKeyShareBytes];
+    std::size_t pub_len = sizeof(pub);
+    if (ctx && EVP_PKEY_keygen_init(ctx) == 1 && EVP_PKEY_keygen(ctx, &key) == 1 &&
+        EVP_PKEY_get_raw_public_key(key, pub, &pub_len) == 1 && pub_len == sizeof(pub)) {
+        key_ = key;
+        public_hex_ = to_hex(pub, sizeof(pub));
+    } else {
+        EVP_PKEY_free(key);
     }
+    EVP_PKEY_CTX_free(ctx);
+}
+
+KeyExchange::~KeyExchange() {
+    EVP_PKEY_free(key_);
+}
 
-    // Clean up context
-    EVP_CIPHER_CTX_free(ctx);
+bool KeyExchange::derive(const std::string& peer_hex, bool client, GcmKeys& out,
+                         std::string& error) const {
+    std::uint8_t peer[kKeyShareBytes];
+    if (!key_ || !from_hex(peer_hex, peer, sizeof(peer))) {
+        error = "invalid key share";
+        return false;
+    }
+    // OpenSSL refuses the all-zero secret a low-order peer key would give.
+    std::uint8_t secret[32];
+    std::size_t secret_len = sizeof(secret);
+    EVP_PKEY* peer_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, peer, sizeof(peer));
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(key_, nullptr);
+    const bool agreed = peer_key && ctx && EVP_PKEY_derive_init(ctx) == 1 &&
+                        EVP_PKEY_derive_set_peer(ctx, peer_key) == 1 &&
+                        EVP_PKEY_derive(ctx, secret, &secret_len) == 1 &&
+                        secret_len == sizeof(secret);
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer_key);
+    if (!agreed) {
+        error = "X25519 key agreement failed";
+        return false;
+    }
 
-    // Resize vector to actual decrypted length
-    plaintext.resize(len1 + len2);
-    return plaintext;
+    // Both public keys, client first, salt the expansion, so each side ends
+    // up with the same client-to-server and server-to-client keys.
+    std::uint8_t salt[2 * kKeyShareBytes];
+    std::uint8_t own[kKeyShareBytes];
+    from_hex(public_hex_, own, sizeof(own));
+    std::memcpy(salt, client ? own : peer, kKeyShareBytes);
+    std::memcpy(salt + kKeyShareBytes, client ? peer : own, kKeyShareBytes);
+    static constexpr char kInfo[] = "quiz v2 AES-256-GCM frame keys";
+    std::uint8_t keys[2 * kGcmKeyBytes];
+    EVP_KDF* kdf = EVP_KDF_fetch(nullptr, "HKDF", nullptr);
+    EVP_KDF_CTX* kctx = kdf ? EVP_KDF_CTX_new(kdf) : nullptr;
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, secret, sizeof(secret)),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, salt, sizeof(salt)),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, const_cast<char*>(kInfo),
+                                          sizeof(kInfo) - 1),
+        OSSL_PARAM_construct_end()};
+    const bool derived = kctx && EVP_KDF_derive(kctx, keys, sizeof(keys), params) == 1;
+    EVP_KDF_CTX_free(kctx);
+    EVP_KDF_free(kdf);
+    OPENSSL_cleanse(secret, sizeof(secret));
+    if (!derived) {
+        error = "HKDF failed";
+        return false;
+    }
+    const std::uint8_t* to_server = keys;
+    const std::uint8_t* to_client = keys + kGcmKeyBytes;
+    std::memcpy(out.send, client ? to_server : to_client, kGcmKeyBytes);
+    std::memcpy(out.recv, client ? to_client : to_server, kGcmKeyBytes);
+    OPENSSL_cleanse(keys, sizeof(keys));
+    return true;
 }
 
 }  // namespace quiz
@@ -1,10 +1,15 @@
 #include "common/codec.hpp"
 #include "common/aes_crypto.hpp"
+#include "common/compress.hpp"
+#include "common/data_writer.hpp"
+#include "common/utf8.hpp"
 
 #include <array>
 #include <cerrno>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
+#include <string_view>
 #include <system_error>
 
 #include <unistd.h>
@@ -14,35 +19,239 @@
 namespace quiz {
 namespace {
 
-bool is_valid_utf8(const std::string& s) {
-  const unsigned char* bytes =
-      reinterpret_cast<const unsigned char*>(s.data());
-  std::size_t len = s.size();
-  std::size_t i = 0;
-  while (i < len) {
-    unsigned char c = bytes[i];
-    std::size_t remaining = 0;
-    if (c <= 0x7F) {
-      remaining = 0;
-    } else if ((c >> 5) == 0x6) {
-      remaining = 1;
-      if ((c & 0x1E) == 0) return false;
-    } else if ((c >> 4) == 0xE) {
-      remaining = 2;
-    } else if ((c >> 3) == 0x1E) {
-      remaining = 3;
-    } else {
+// Binary encodings carry strings without any UTF-8 guarantee, so every key
+// and string value is checked before the envelope is trusted. Binary blobs
+// have no JSON equivalent and are refused.
+bool has_valid_strings(const nlohmann::json& j, std::string& error) {
+  switch (j.type()) {
+    case nlohmann::json::value_t::string:
+      if (!is_valid_utf8(j.get_ref<const std::string&>())) {
+        error = "string not valid UTF-8";
+        return false;
+      }
+      return true;
+    case nlohmann::json::value_t::binary:
+      error = "binary values are not supported";
       return false;
+    case nlohmann::json::value_t::object:
+      for (auto it = j.begin(); it != j.end(); ++it) {
+        if (!is_valid_utf8(it.key())) {
+          error = "key not valid UTF-8";
+          return false;
+        }
+        if (!has_valid_strings(it.value(), error)) return false;
+      }
+      return true;
+    case nlohmann::json::value_t::array:
+      for (const auto& value : j) {
+        if (!has_valid_strings(value, error)) return false;
+      }
+      return true;
+    default:
+      return true;
+  }
+}
+
+// Appends the serialized envelope of `msg` to `out`, byte for byte what
+// serializing message_to_json would give. False (with `out` unspecified)
+// when a string is not UTF-8 or the result is too large.
+bool write_envelope(const Message& msg, Encoding encoding, std::vector<std::uint8_t>& out,
+                    std::string& error) {
+  // A pending raw_data is only ever re-encoded on rare paths; parse it.
+  nlohmann::json parsed;
+  const nlohmann::json* data = &msg.data;
+  if (!msg.raw_data.empty()) {
+    parsed = nlohmann::json::parse(msg.raw_data, nullptr, false);
+    if (!parsed.is_object()) parsed = nlohmann::json::object();
+    data = &parsed;
+  } else if (msg.data.is_null()) {
+    parsed = nlohmann::json::object();
+    data = &parsed;
+  }
+
+  const std::size_t start = out.size();
+  const bool has_session = !msg.session_id.empty();
+  const bool has_deadline = msg.deadline_ms != 0;
+  const bool has_status = msg.status != Status::None;
+  const bool has_code = !msg.error_code.empty();
+  const bool has_message = !msg.error_message.empty();
+  DataWriter w(out, encoding);
+  w.begin_object(4 + has_session + has_deadline + has_status + has_code + has_message);
+  w.key("action");
+  w.string(msg.action.str());
+  w.key("data");
+  if (msg.write_data) {
+    msg.write_data(w);
+  } else {
+    w.value(*data);
+  }
+  if (has_deadline) {
+    w.key("deadline_ms");
+    w.number(msg.deadline_ms);
+  }
+  if (has_code) {
+    w.key("error_code");
+    w.string(msg.error_code);
+  }
+  if (has_message) {
+    w.key("error_message");
+    w.string(msg.error_message);
+  }
+  w.key("message_type");
+  w.string(to_string(msg.type));
+  if (has_session) {
+    w.key("session_id");
+    w.string(msg.session_id);
+  }
+  if (has_status) {
+    w.key("status");
+    w.string(to_string(msg.status));
+  }
+  w.key("timestamp");
+  w.number(msg.timestamp);
+  w.end_object();
+
+  if (!w.ok()) {
+    error = "payload " + w.error();
+    return false;
+  }
+  if (out.size() - start > kMaxPayloadSize) {
+    error = "payload too large";
+    return false;
+  }
+  return true;
+}
+
+bool parse(const std::vector<std::uint8_t>& bytes, Encoding encoding, nlohmann::json& out,
+           std::string& error) {
+  try {
+    switch (encoding) {
+      case Encoding::Json:
+        if (!is_valid_utf8(bytes.data(), bytes.size())) {
+          error = "decrypted payload not valid UTF-8";
+          return false;
+        }
+        out = nlohmann::json::parse(bytes.begin(), bytes.end());
+        return true;
+      case Encoding::MsgPack:
+        out = nlohmann::json::from_msgpack(bytes);
+        break;
+      case Encoding::Cbor:
+        out = nlohmann::json::from_cbor(bytes);
+        break;
     }
-    if (i + remaining >= len) return false;
-    for (std::size_t j = 1; j <= remaining; ++j) {
-      if ((bytes[i + j] >> 6) != 0x2) return false;
-    }
-    i += remaining + 1;
+  } catch (const std::exception& ex) {
+    error = (encoding == Encoding::Json ? "JSON" : to_string(encoding)) +
+            std::string(" parse error: ") + ex.what();
+    return false;
+  }
+  if (!has_valid_strings(out, error)) {
+    error = "decrypted payload " + error;
+    return false;
   }
   return true;
 }
 
+// Envelope scanner: walks the top level of a JSON object, parsing only the
+// small envelope fields and recording where `data` is. Nested values are
+// skipped by bracket matching; their syntax is checked when parsed later.
+enum class ScanResult { Ok, Fallback, Malformed };
+
+const char* skip_ws(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+  return p;
+}
+
+// `p` is at an opening quote; returns one past the closing one, or nullptr.
+const char* skip_string(const char* p, const char* end, bool* escaped = nullptr) {
+  for (++p; p < end; ++p) {
+    if (*p == '"') return p + 1;
+    if (*p == '\\') {
+      if (escaped) *escaped = true;
+      ++p;
+    }
+  }
+  return nullptr;
+}
+
+// Returns one past the end of the value starting at `p`, or nullptr.
+const char* skip_value(const char* p, const char* end) {
+  if (p >= end) return nullptr;
+  if (*p == '"') return skip_string(p, end);
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = skip_string(p, end);
+        if (!p) return nullptr;
+        continue;
+      }
+      if (*p == '{' || *p == '[') ++depth;
+      if (*p == '}' || *p == ']') {
+        if (--depth == 0) return p + 1;
+      }
+      ++p;
+    }
+    return nullptr;
+  }
+  const char* start = p;
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' &&
+         *p != '\n' && *p != '\r') {
+    ++p;
+  }
+  return p == start ? nullptr : p;
+}
+
+bool is_envelope_key(std::string_view key) {
+  return key == "message_type" || key == "action" || key == "timestamp" ||
+         key == "session_id" || key == "deadline_ms" || key == "status" ||
+         key == "error_code" || key == "error_message";
+}
+
+ScanResult scan_envelope(std::string_view text, nlohmann::json& fields,
+                         std::string_view& data) {
+  const char* p = skip_ws(text.data(), text.data() + text.size());
+  const char* end = text.data() + text.size();
+  if (p == end || *p != '{') return ScanResult::Fallback;  // let the parser explain
+  p = skip_ws(p + 1, end);
+  if (p < end && *p == '}') {
+    ++p;
+  } else {
+    while (true) {
+      if (p == end || *p != '"') return ScanResult::Malformed;
+      bool escaped = false;
+      const char* key_end = skip_string(p, end, &escaped);
+      if (!key_end) return ScanResult::Malformed;
+      if (escaped) return ScanResult::Fallback;
+      const std::string_view key(p + 1, static_cast<std::size_t>(key_end - p - 2));
+      p = skip_ws(key_end, end);
+      if (p == end || *p != ':') return ScanResult::Malformed;
+      p = skip_ws(p + 1, end);
+      const char* value_end = skip_value(p, end);
+      if (!value_end) return ScanResult::Malformed;
+      const std::string_view value(p, static_cast<std::size_t>(value_end - p));
+      if (key == "data") {
+        data = value;
+      } else if (is_envelope_key(key)) {
+        auto parsed = nlohmann::json::parse(value.begin(), value.end(), nullptr, false);
+        if (parsed.is_discarded()) return ScanResult::Malformed;
+        fields[std::string(key)] = std::move(parsed);
+      }
+      p = skip_ws(value_end, end);
+      if (p < end && *p == ',') {
+        p = skip_ws(p + 1, end);
+        continue;
+      }
+      if (p < end && *p == '}') {
+        ++p;
+        break;
+      }
+      return ScanResult::Malformed;
+    }
+  }
+  return skip_ws(p, end) == end ? ScanResult::Ok : ScanResult::Malformed;
+}
+
 std::uint32_t to_be32(std::uint32_t value) {
   return ((value & 0x000000FFu) << 24) | ((value & 0x0000FF00u) << 8) |
          ((value & 0x00FF0000u) >> 8) | ((value & 0xFF000000u) >> 24);
@@ -52,8 +261,67 @@ std::uint32_t from_be32(std::uint32_t value) {
   return to_be32(value);
 }
 
+// Flag bits understood by this build; frames using others are rejected.
+constexpr std::uint8_t kKnownFrameFlags = kFrameFlagDeflate | kFrameFlagAcceptDeflate |
+                                          kFrameFlagChunk | kFrameFlagEndOfStream |
+                                          kFrameFlagGcm | kFrameFlagPlaintext;
+
+void write_header(std::uint8_t* out, const FrameHeader& header) {
+  out[0] = static_cast<std::uint8_t>(kFrameMagic >> 8);
+  out[1] = static_cast<std::uint8_t>(kFrameMagic & 0xFF);
+  out[2] = kProtocolV2;
+  out[3] = header.flags;
+  out[4] = static_cast<std::uint8_t>(header.encoding);
+  out[5] = static_cast<std::uint8_t>(header.priority);
+  out[6] = static_cast<std::uint8_t>(header.sequence >> 8);
+  out[7] = static_cast<std::uint8_t>(header.sequence & 0xFF);
+  std::uint32_t id = to_be32(header.request_id);
+  std::memcpy(out + 8, &id, sizeof(id));
+}
+
+// Bytes of padding that keep a GCM or plaintext payload, whose length
+// otherwise follows the envelope's, at the v2 length residue; `overhead` is
+// what the cipher adds. Always 1 to 16, each byte holding the count, so the
+// receiver can strip it (for GCM, once the tag has verified).
+std::size_t residue_padding(std::size_t envelope_len, std::size_t overhead) {
+  return 16 - (envelope_len + overhead) % 16;
+}
+
+// Strips what residue_padding added. False if the padding is malformed.
+bool strip_padding(std::vector<std::uint8_t>& plain) {
+  const std::size_t pad = plain.empty() ? 0 : plain.back();
+  if (pad == 0 || pad > 16 || pad > plain.size()) return false;
+  plain.resize(plain.size() - pad);
+  return true;
+}
+
+// v2 payloads start with the magic and are never a whole number of blocks.
+bool has_v2_header(const std::uint8_t* payload, std::size_t payload_len) {
+  return payload_len >= kFrameHeaderBytes && payload_len % 16 == kFrameHeaderBytes % 16 &&
+         payload[0] == (kFrameMagic >> 8) && payload[1] == (kFrameMagic & 0xFF);
+}
+
 }  // namespace
 
+std::string to_string(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::Json:
+      return "JSON";
+    case Encoding::MsgPack:
+      return "MSGPACK";
+    case Encoding::Cbor:
+      return "CBOR";
+  }
+  return "JSON";
+}
+
+std::optional<Encoding> encoding_from_string(const std::string& value) {
+  if (value == "JSON") return Encoding::Json;
+  if (value == "MSGPACK") return Encoding::MsgPack;
+  if (value == "CBOR") return Encoding::Cbor;
+  return std::nullopt;
+}
+
 // Message helpers implementation
 std::string to_string(MessageType type) {
   switch (type) {
@@ -113,12 +381,11 @@ std::optional<Message> message_from_json(const nlohmann::json& j,
   }
   msg.type = *mt;
 
-  if (!j.contains("action") || !j["action"].is_string() ||
-      j["action"].get<std::string>().empty()) {
-    error = "action missing or empty";
+  if (!j.contains("action") || !j["action"].is_string()) {
+    error = "action missing or not string";
     return std::nullopt;
   }
-  msg.action = j["action"].get<std::string>();
+  msg.action = j["action"].get_ref<const std::string&>();
 
   if (!j.contains("timestamp") || !j["timestamp"].is_number_unsigned()) {
     error = "timestamp missing or not unsigned number";
@@ -134,6 +401,16 @@ std::optional<Message> message_from_json(const nlohmann::json& j,
     msg.session_id = j["session_id"].get<std::string>();
   }
 
+  if (j.contains("deadline_ms")) {
+    if (!j["deadline_ms"].is_number_unsigned() ||
+        j["deadline_ms"].get<std::uint64_t>() >
+            std::numeric_limits<std::uint32_t>::max()) {
+      error = "deadline_ms must be unsigned 32-bit number";
+      return std::nullopt;
+    }
+    msg.deadline_ms = j["deadline_ms"].get<std::uint32_t>();
+  }
+
   if (j.contains("data")) {
     if (!j["data"].is_object()) {
       error = "data must be JSON object";
@@ -179,22 +456,58 @@ std::optional<Message> message_from_json(const nlohmann::json& j,
     return std::nullopt;
   }
 
+  // Only an error response may leave the action empty: a request the server
+  // refused before reading it, which the client matches by request_id.
+  if (msg.action.empty() &&
+      (msg.type != MessageType::Response || msg.status != Status::Error)) {
+    error = "action missing or empty";
+    return std::nullopt;
+  }
+
   return msg;
 }
 
 nlohmann::json message_to_json(const Message& msg) {
   nlohmann::json j;
   j["message_type"] = to_string(msg.type);
-  j["action"] = msg.action;
+  j["action"] = msg.action.str();
   j["timestamp"] = msg.timestamp;
   if (!msg.session_id.empty()) j["session_id"] = msg.session_id;
-  j["data"] = msg.data.is_null() ? nlohmann::json::object() : msg.data;
+  if (msg.deadline_ms != 0) j["deadline_ms"] = msg.deadline_ms;
+  if (msg.write_data) {
+    std::vector<std::uint8_t> text;
+    DataWriter w(text, Encoding::Json);
+    msg.write_data(w);
+    j["data"] = nlohmann::json::parse(text.begin(), text.end(), nullptr, false);
+    if (!w.ok() || !j["data"].is_object()) j["data"] = nlohmann::json::object();
+  } else if (!msg.raw_data.empty()) {
+    j["data"] = nlohmann::json::parse(msg.raw_data, nullptr, false);
+    if (!j["data"].is_object()) j["data"] = nlohmann::json::object();
+  } else {
+    j["data"] = msg.data.is_null() ? nlohmann::json::object() : msg.data;
+  }
   if (msg.status != Status::None) j["status"] = to_string(msg.status);
   if (!msg.error_code.empty()) j["error_code"] = msg.error_code;
   if (!msg.error_message.empty()) j["error_message"] = msg.error_message;
   return j;
 }
 
+bool materialize_data(Message& msg, std::string& error) {
+  if (msg.raw_data.empty()) return true;
+  try {
+    msg.data = nlohmann::json::parse(msg.raw_data);
+  } catch (const std::exception& ex) {
+    error = std::string("JSON parse error in data: ") + ex.what();
+    return false;
+  }
+  if (!msg.data.is_object()) {
+    error = "data must be JSON object";
+    return false;
+  }
+  msg.raw_data.clear();
+  return true;
+}
+
 ssize_t read_exact(int fd, void* buffer, std::size_t length) {
   auto* out = static_cast<std::uint8_t*>(buffer);
   std::size_t total = 0;
@@ -227,94 +540,282 @@ ssize_t write_exact(int fd, const void* buffer, std::size_t length) {
 }
 
 std::vector<std::uint8_t> encode_frame(const Message& msg, std::string& error) {
-  nlohmann::json payload = message_to_json(msg);
-  std::string json_str = payload.dump();
-  if (json_str.size() > kMaxPayloadSize) {
-    error = "payload too large";
-    return {};
+  return encode_frame(msg, FrameHeader{}, error);
+}
+
+std::vector<std::uint8_t> encode_frame(const Message& msg, const FrameHeader& header,
+                                       std::string& error) {
+  std::vector<std::uint8_t> frame;
+  if (!encode_frame_into(msg, header, frame, error)) return {};
+  return frame;
+}
+
+bool encode_frame_into(const Message& msg, const FrameHeader& header,
+                       std::vector<std::uint8_t>& frame, std::string& error,
+                       const GcmFrameKey* gcm_key) {
+  frame.clear();
+  if (header.version != kProtocolV1 && header.version != kProtocolV2) {
+    error = "unsupported protocol version";
+    return false;
   }
-  if (!is_valid_utf8(json_str)) {
-    error = "payload not valid UTF-8";
-    return {};
+  const Encoding encoding =
+      header.version == kProtocolV2 ? header.encoding : Encoding::Json;
+  const std::size_t header_len = header.version == kProtocolV2 ? kFrameHeaderBytes : 0;
+  const bool gcm = header.version == kProtocolV2 && (header.flags & kFrameFlagGcm);
+  const bool plaintext = header.version == kProtocolV2 && (header.flags & kFrameFlagPlaintext);
+  if (gcm && plaintext) {
+    error = "conflicting cipher flags";
+    return false;
+  }
+  if (gcm && (!gcm_key || !gcm_key->key)) {
+    error = "GCM frame without a connection key";
+    return false;
+  }
+  const std::size_t body = kFramePrefixBytes + header_len + (gcm ? kGcmNonceBytes : 0);
+
+  // Layout: prefix, header, (GCM nonce,) then the envelope serialized in
+  // place; the prefix is filled in once the ciphertext length is known.
+  frame.resize(body);
+  if (!write_envelope(msg, encoding, frame, error)) {
+    frame.clear();
+    return false;
   }
 
-  // Encrypt the JSON payload using AES-256-CBC
-  auto encrypted = encrypt_aes_cbc(
-      reinterpret_cast<const std::uint8_t*>(json_str.data()),
-      json_str.size(),
-      error
-  );
-  if (encrypted.empty()) {
+  FrameHeader wire = header;
+  wire.flags &= ~kFrameFlagDeflate;
+  if (header.version == kProtocolV2 && (header.flags & kFrameFlagDeflate) &&
+      frame.size() - body >= kCompressThreshold) {
+    thread_local std::vector<std::uint8_t> packed;
+    packed.clear();
+    if (deflate_payload(frame.data() + body, frame.size() - body, packed, error) &&
+        packed.size() < frame.size() - body) {
+      frame.resize(body);
+      frame.insert(frame.end(), packed.begin(), packed.end());
+      wire.flags |= kFrameFlagDeflate;
+    }
+  }
+
+  if (gcm) {
+    // The header is authenticated too, so it must be final by now.
+    std::uint8_t aad[kFrameHeaderBytes];
+    write_header(aad, wire);
+    const std::size_t pad =
+        residue_padding(frame.size() - body, kGcmNonceBytes + kGcmTagBytes);
+    frame.insert(frame.end(), pad, static_cast<std::uint8_t>(pad));
+    if (!encrypt_aes_gcm_in_place(frame, body, gcm_key->key, gcm_key->sequence, aad,
+                                  sizeof(aad), error)) {
+      error = "encryption failed: " + error;
+      frame.clear();
+      return false;
+    }
+  } else if (plaintext) {
+    const std::size_t pad = residue_padding(frame.size() - body, 0);
+    frame.insert(frame.end(), pad, static_cast<std::uint8_t>(pad));
+  } else if (!encrypt_aes_cbc_in_place(frame, body, error)) {
     error = "encryption failed: " + error;
-    return {};
+    frame.clear();
+    return false;
   }
 
-  // Build frame with encrypted payload
-  std::vector<std::uint8_t> frame;
-  frame.resize(kFramePrefixBytes + encrypted.size());
-  std::uint32_t len = static_cast<std::uint32_t>(encrypted.size());
+  std::uint32_t len = static_cast<std::uint32_t>(frame.size() - kFramePrefixBytes);
   len = to_be32(len);
   std::memcpy(frame.data(), &len, sizeof(len));
-  std::memcpy(frame.data() + kFramePrefixBytes, encrypted.data(),
-              encrypted.size());
-  return frame;
+  if (header_len > 0) write_header(frame.data() + kFramePrefixBytes, wire);
+  return true;
+}
+
+FrameHeader reply_header(const FrameHeader& request) {
+  FrameHeader reply = request;
+  reply.flags = ((request.flags & kFrameFlagAcceptDeflate) ? kFrameFlagDeflate : 0) |
+                (request.flags & (kFrameFlagGcm | kFrameFlagPlaintext));
+  reply.sequence = 0;
+  return reply;
+}
+
+bool peek_frame_header(const std::uint8_t* frame, std::size_t size, FrameHeader& out,
+                       std::string& error) {
+  if (size < kFramePrefixBytes) {
+    error = "frame too small";
+    return false;
+  }
+  const std::uint8_t* payload = frame + kFramePrefixBytes;
+  const std::size_t payload_len = size - kFramePrefixBytes;
+  out = FrameHeader{};
+  if (!has_v2_header(payload, payload_len)) return true;
+
+  if (payload[2] != kProtocolV2) {
+    error = "unsupported protocol version";
+    return false;
+  }
+  if ((payload[3] & ~kKnownFrameFlags) != 0) {
+    error = "unsupported frame flags";
+    return false;
+  }
+  if ((payload[3] & kFrameFlagGcm) && (payload[3] & kFrameFlagPlaintext)) {
+    error = "conflicting cipher flags";
+    return false;
+  }
+  if ((payload[3] & kFrameFlagEndOfStream) && !(payload[3] & kFrameFlagChunk)) {
+    error = "end of stream outside a stream";
+    return false;
+  }
+  if (payload[4] > static_cast<std::uint8_t>(Encoding::Cbor)) {
+    error = "unsupported encoding";
+    return false;
+  }
+  if (payload[5] > static_cast<std::uint8_t>(Priority::High)) {
+    error = "invalid priority";
+    return false;
+  }
+  out.version = kProtocolV2;
+  out.flags = payload[3];
+  out.encoding = static_cast<Encoding>(payload[4]);
+  out.sequence = static_cast<std::uint16_t>((payload[6] << 8) | payload[7]);
+  out.priority = static_cast<Priority>(payload[5]);
+  std::uint32_t id = 0;
+  std::memcpy(&id, payload + 8, sizeof(id));
+  out.request_id = from_be32(id);
+  return true;
 }
 
 bool decode_frame(const std::vector<std::uint8_t>& frame, Message& out,
                   std::string& error) {
+  FrameHeader header;
+  return decode_frame(frame, out, header, error);
+}
+
+namespace {
+
+// Reused by every decode on the thread; the decoded Message copies what it
+// keeps, so nothing refers to it once decode_frame returns.
+std::vector<std::uint8_t>& plaintext_buffer() {
+  thread_local std::vector<std::uint8_t> plain;
+  return plain;
+}
+
+// Checks the length, reads the header and decrypts; `plain` receives the
+// serialized envelope. A GCM frame only opens under its connection's key
+// and with the sequence number the receiver expects next (see GcmFrameKey),
+// so a frame replayed on its own or another connection is refused. v1 and
+// CBC frames still use the shared AES_KEY and have no such check.
+bool open_frame(const std::vector<std::uint8_t>& frame, FrameHeader& header,
+                std::vector<std::uint8_t>& plain, std::string& error,
+                const GcmFrameKey* gcm) {
   if (frame.size() < kFramePrefixBytes) {
     error = "frame too small";
     return false;
   }
   std::uint32_t be_len = 0;
   std::memcpy(&be_len, frame.data(), sizeof(be_len));
-  const std::uint32_t encrypted_len = from_be32(be_len);
+  const std::uint32_t payload_len = from_be32(be_len);
 
   // Note: encrypted payload can be larger than kMaxPayloadSize due to padding
   // We'll check the decrypted size instead
 
-  if (frame.size() != kFramePrefixBytes + encrypted_len) {
+  if (frame.size() != kFramePrefixBytes + payload_len) {
     error = "payload length mismatch";
     return false;
   }
+  if (!peek_frame_header(frame.data(), frame.size(), header, error)) return false;
+  const std::size_t header_len = header.version == kProtocolV2 ? kFrameHeaderBytes : 0;
 
-  // Decrypt the encrypted payload
-  auto decrypted = decrypt_aes_cbc(
-      frame.data() + kFramePrefixBytes,
-      encrypted_len,
-      error
-  );
-  if (decrypted.empty()) {
+  // Decrypt the encrypted payload. A GCM frame is authenticated, header
+  // included, before any of it is looked at, so tampering stops here.
+  const std::uint8_t* payload = frame.data() + kFramePrefixBytes;
+  if (header.flags & kFrameFlagGcm) {
+    if (!gcm || !gcm->key) {
+      error = "GCM frame without a connection key";
+      return false;
+    }
+    if (!decrypt_aes_gcm_into(payload + header_len, payload_len - header_len, gcm->key,
+                              gcm->sequence, payload, header_len, plain, error)) {
+      error = "decryption failed: " + error;
+      return false;
+    }
+    if (!strip_padding(plain)) {
+      error = "decryption failed: invalid GCM padding";
+      return false;
+    }
+  } else if (header.flags & kFrameFlagPlaintext) {
+    plain.assign(payload + header_len, payload + payload_len);
+    if (!strip_padding(plain)) {
+      error = "invalid plaintext padding";
+      return false;
+    }
+  } else if (!decrypt_aes_cbc_into(payload + header_len, payload_len - header_len, plain,
+                                   error)) {
     error = "decryption failed: " + error;
     return false;
   }
 
-  // Reconstruct JSON string from decrypted bytes
-  std::string payload(reinterpret_cast<const char*>(decrypted.data()),
-                      decrypted.size());
+  if (header.flags & kFrameFlagDeflate) {
+    thread_local std::vector<std::uint8_t> unpacked;
+    if (!inflate_payload(plain.data(), plain.size(), kMaxPayloadSize, unpacked, error)) {
+      error = "decompression failed: " + error;
+      return false;
+    }
+    plain.swap(unpacked);
+  }
 
   // Check decrypted payload size
-  if (payload.size() > kMaxPayloadSize) {
+  if (plain.size() > kMaxPayloadSize) {
     error = "decrypted payload too large";
     return false;
   }
+  return true;
+}
 
-  if (!is_valid_utf8(payload)) {
+bool decode_full(const std::vector<std::uint8_t>& plain, Encoding encoding, Message& out,
+                 std::string& error) {
+  nlohmann::json j;
+  if (!parse(plain, encoding, j, error)) return false;
+
+  auto msg = message_from_json(j, error);
+  if (!msg) return false;
+  out = std::move(*msg);
+  return true;
+}
+
+}  // namespace
+
+bool decode_frame(const std::vector<std::uint8_t>& frame, Message& out, FrameHeader& header,
+                  std::string& error, const GcmFrameKey* gcm) {
+  auto& plain = plaintext_buffer();
+  if (!open_frame(frame, header, plain, error, gcm)) return false;
+  return decode_full(plain, header.encoding, out, error);
+}
+
+bool decode_frame_envelope(const std::vector<std::uint8_t>& frame, Message& out,
+                           FrameHeader& header, std::string& error,
+                           const GcmFrameKey* gcm) {
+  auto& plain = plaintext_buffer();
+  if (!open_frame(frame, header, plain, error, gcm)) return false;
+  if (header.encoding != Encoding::Json) return decode_full(plain, header.encoding, out, error);
+
+  if (!is_valid_utf8(plain.data(), plain.size())) {
     error = "decrypted payload not valid UTF-8";
     return false;
   }
-
-  nlohmann::json j;
-  try {
-    j = nlohmann::json::parse(payload);
-  } catch (const std::exception& ex) {
-    error = std::string("JSON parse error: ") + ex.what();
+  const std::string_view text(reinterpret_cast<const char*>(plain.data()), plain.size());
+  nlohmann::json fields = nlohmann::json::object();
+  std::string_view data;
+  switch (scan_envelope(text, fields, data)) {
+    case ScanResult::Fallback:
+      return decode_full(plain, header.encoding, out, error);
+    case ScanResult::Malformed:
+      error = "JSON parse error: malformed envelope";
+      return false;
+    case ScanResult::Ok:
+      break;
+  }
+  if (!data.empty() && data.front() != '{') {
+    error = "data must be JSON object";
     return false;
   }
-
-  auto msg = message_from_json(j, error);
+  auto msg = message_from_json(fields, error);
   if (!msg) return false;
-  out = *msg;
+  out = std::move(*msg);
+  out.raw_data.assign(data);
   return true;
 }
 
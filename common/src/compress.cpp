@@ -0,0 +1,125 @@
+#include "common/compress.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+
+namespace quiz {
+namespace {
+
+constexpr char kDictionary[] =
+#include "deflate_dictionary.inc"
+    ;
+
+// Speed matters more than the last few percent: most frames are a few KB
+// and the dictionary does the heavy lifting.
+constexpr int kLevel = 3;
+
+const Bytef* dictionary() {
+  return reinterpret_cast<const Bytef*>(kDictionary);
+}
+
+constexpr uInt kDictionaryLen = sizeof(kDictionary) - 1;
+
+// zlib streams are costly to set up (~300 KB for deflate), so each thread
+// keeps one of each and resets it between frames.
+struct Deflater {
+  z_stream zs{};
+  bool ok{false};
+  Deflater() { ok = deflateInit(&zs, kLevel) == Z_OK; }
+  ~Deflater() {
+    if (ok) deflateEnd(&zs);
+  }
+};
+
+struct Inflater {
+  z_stream zs{};
+  bool ok{false};
+  Inflater() { ok = inflateInit(&zs) == Z_OK; }
+  ~Inflater() {
+    if (ok) inflateEnd(&zs);
+  }
+};
+
+}  // namespace
+
+std::uint32_t compression_dictionary_id() {
+  static const std::uint32_t id =
+      static_cast<std::uint32_t>(adler32(adler32(0L, Z_NULL, 0), dictionary(), kDictionaryLen));
+  return id;
+}
+
+bool deflate_payload(const std::uint8_t* data, std::size_t len, std::vector<std::uint8_t>& out,
+                     std::string& error) {
+  thread_local Deflater d;
+  if (!d.ok || deflateReset(&d.zs) != Z_OK ||
+      deflateSetDictionary(&d.zs, dictionary(), kDictionaryLen) != Z_OK) {
+    error = "deflate init failed";
+    return false;
+  }
+  const std::size_t start = out.size();
+  out.resize(start + deflateBound(&d.zs, static_cast<uLong>(len)));
+  d.zs.next_in = const_cast<Bytef*>(data);
+  d.zs.avail_in = static_cast<uInt>(len);
+  d.zs.next_out = out.data() + start;
+  d.zs.avail_out = static_cast<uInt>(out.size() - start);
+  if (deflate(&d.zs, Z_FINISH) != Z_STREAM_END) {
+    out.resize(start);
+    error = "deflate failed";
+    return false;
+  }
+  out.resize(start + d.zs.total_out);
+  return true;
+}
+
+bool inflate_payload(const std::uint8_t* data, std::size_t len, std::size_t max_len,
+                     std::vector<std::uint8_t>& out, std::string& error) {
+  thread_local Inflater inf;
+  if (!inf.ok || inflateReset(&inf.zs) != Z_OK) {
+    error = "inflate init failed";
+    return false;
+  }
+  out.resize(std::min<std::size_t>(max_len, len * 4 + 1024));
+  inf.zs.next_in = const_cast<Bytef*>(data);
+  inf.zs.avail_in = static_cast<uInt>(len);
+  inf.zs.next_out = out.data();
+  inf.zs.avail_out = static_cast<uInt>(out.size());
+  while (true) {
+    int rc = inflate(&inf.zs, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) break;
+    if (rc == Z_NEED_DICT) {
+      if (inf.zs.adler != compression_dictionary_id() ||
+          inflateSetDictionary(&inf.zs, dictionary(), kDictionaryLen) != Z_OK) {
+        error = "compressed with an unknown dictionary";
+        return false;
+      }
+      continue;
+    }
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      error = "inflate failed";
+      return false;
+    }
+    if (inf.zs.avail_out == 0) {
+      // Output full: grow, but never past the limit.
+      if (out.size() >= max_len) {
+        error = "decompressed payload too large";
+        return false;
+      }
+      const std::size_t used = out.size();
+      out.resize(std::min(max_len, used * 2));
+      inf.zs.next_out = out.data() + used;
+      inf.zs.avail_out = static_cast<uInt>(out.size() - used);
+      continue;
+    }
+    error = "truncated compressed payload";
+    return false;
+  }
+  if (inf.zs.avail_in != 0) {
+    error = "trailing data after compressed payload";
+    return false;
+  }
+  out.resize(inf.zs.total_out);
+  return true;
+}
+
+}  // namespace quiz
@@ -1,27 +1,142 @@
 #include "common/crypto.hpp"
 
+#include <cstdint>
 #include <functional>
 #include <sstream>
 #include <string>
+#include <vector>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 
 namespace quiz {
 
 namespace {
-std::string to_hex(std::size_t value) {
+
+// Current cost: N = 2^14, r = 8, p = 1 takes 16 MiB and some tens of
+// milliseconds per hash. Raising it makes older hashes report needs_rehash.
+constexpr int kScryptLogN = 14;
+constexpr int kScryptR = 8;
+constexpr int kScryptP = 1;
+constexpr std::size_t kSaltBytes = 16;
+constexpr std::size_t kKeyBytes = 32;
+
+struct ScryptHash {
+  int log_n{};
+  int r{};
+  int p{};
+  std::vector<std::uint8_t> salt;
+  std::vector<std::uint8_t> key;
+};
+
+std::string to_hex(const std::uint8_t* data, std::size_t len) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string out;
+  out.reserve(len * 2);
+  for (std::size_t i = 0; i < len; ++i) {
+    out.push_back(kHex[data[i] >> 4]);
+    out.push_back(kHex[data[i] & 0xF]);
+  }
+  return out;
+}
+
+bool from_hex(const std::string& text, std::vector<std::uint8_t>& out) {
+  if (text.empty() || text.size() % 2 != 0) return false;
+  auto nibble = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+  };
+  out.resize(text.size() / 2);
+  for (std::size_t i = 0; i < out.size(); ++i) {
+    const int hi = nibble(text[2 * i]);
+    const int lo = nibble(text[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out[i] = static_cast<std::uint8_t>(hi << 4 | lo);
+  }
+  return true;
+}
+
+bool parse_int(const std::string& text, int max, int& out) {
+  if (text.empty() || text.size() > 3) return false;
+  out = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') return false;
+    out = out * 10 + (c - '0');
+  }
+  return out >= 1 && out <= max;
+}
+
+// "$scrypt$14$8$1$<salt>$<key>"; the bounds keep a corrupt row from asking
+// for gigabytes.
+bool parse_scrypt(const std::string& stored, ScryptHash& out) {
+  std::vector<std::string> fields;
+  std::istringstream in(stored);
+  std::string field;
+  while (std::getline(in, field, '$')) fields.push_back(field);
+  return fields.size() == 7 && stored.back() != '$' && fields[0].empty() &&
+         fields[1] == "scrypt" && parse_int(fields[2], 20, out.log_n) &&
+         parse_int(fields[3], 32, out.r) && parse_int(fields[4], 16, out.p) &&
+         from_hex(fields[5], out.salt) && from_hex(fields[6], out.key);
+}
+
+bool scrypt(const std::string& password, const ScryptHash& params, std::uint8_t* key,
+            std::size_t key_len) {
+  const std::uint64_t n = std::uint64_t{1} << params.log_n;
+  // The V array, plus the B and XY scratch blocks.
+  const std::uint64_t max_mem =
+      128 * static_cast<std::uint64_t>(params.r) * (n + params.p + 2) + (1 << 20);
+  return EVP_PBE_scrypt(password.data(), password.size(), params.salt.data(),
+                        params.salt.size(), n, static_cast<std::uint64_t>(params.r),
+                        static_cast<std::uint64_t>(params.p), max_mem, key, key_len) == 1;
+}
+
+// The format every account used before hashes were versioned.
+std::string legacy_hash(const std::string& password) {
   std::ostringstream oss;
-  oss << std::hex << value;
+  oss << std::hex << std::hash<std::string>{}("quiz_salt" + password);
   return oss.str();
 }
+
 }  // namespace
 
-std::string hash_password(const std::string& password, const std::string& salt) {
-  std::hash<std::string> h;
-  auto v = h(salt + password);
-  return to_hex(v);
+std::string hash_password(const std::string& password) {
+  ScryptHash params{kScryptLogN, kScryptR, kScryptP, std::vector<std::uint8_t>(kSaltBytes), {}};
+  std::uint8_t key[kKeyBytes];
+  if (RAND_bytes(params.salt.data(), static_cast<int>(kSaltBytes)) != 1 ||
+      !scrypt(password, params, key, sizeof(key))) {
+    return {};
+  }
+  std::ostringstream oss;
+  oss << "$scrypt$" << kScryptLogN << '$' << kScryptR << '$' << kScryptP << '$'
+      << to_hex(params.salt.data(), params.salt.size()) << '$' << to_hex(key, sizeof(key));
+  return oss.str();
 }
 
-bool verify_password(const std::string& password, const std::string& stored_hash, const std::string& salt) {
-  return hash_password(password, salt) == stored_hash;
+bool verify_password(const std::string& password, const std::string& stored_hash,
+                     bool* needs_rehash) {
+  if (needs_rehash) *needs_rehash = false;
+  if (stored_hash.empty()) return false;
+  if (stored_hash[0] != '$') {
+    const std::string computed = legacy_hash(password);
+    const bool ok = computed.size() == stored_hash.size() &&
+                    CRYPTO_memcmp(computed.data(), stored_hash.data(), computed.size()) == 0;
+    if (needs_rehash) *needs_rehash = ok;
+    return ok;
+  }
+  ScryptHash params;
+  if (!parse_scrypt(stored_hash, params)) return false;
+  std::vector<std::uint8_t> key(params.key.size());
+  if (!scrypt(password, params, key.data(), key.size()) ||
+      CRYPTO_memcmp(key.data(), params.key.data(), key.size()) != 0) {
+    return false;
+  }
+  if (needs_rehash) {
+    *needs_rehash = params.log_n != kScryptLogN || params.r != kScryptR ||
+                    params.p != kScryptP || params.key.size() != kKeyBytes;
+  }
+  return true;
 }
 
 }  // namespace quiz
@@ -0,0 +1,359 @@
+#include "common/data_writer.hpp"
+
+#include <memory>
+
+#include "common/utf8.hpp"
+
+namespace quiz {
+namespace {
+
+// nlohmann output adapter appending to a byte vector. Each thread keeps one
+// per character type and points it at the frame being built, so serializing
+// allocates nothing beyond the growth of that frame.
+template <typename CharT>
+class ByteSink : public nlohmann::detail::output_adapter_protocol<CharT> {
+ public:
+  void target(std::vector<std::uint8_t>& out) { out_ = &out; }
+  void write_character(CharT c) override { out_->push_back(static_cast<std::uint8_t>(c)); }
+  void write_characters(const CharT* s, std::size_t length) override {
+    const auto* bytes = reinterpret_cast<const std::uint8_t*>(s);
+    out_->insert(out_->end(), bytes, bytes + length);
+  }
+
+ private:
+  std::vector<std::uint8_t>* out_{nullptr};
+};
+
+template <typename CharT>
+const std::shared_ptr<ByteSink<CharT>>& byte_sink(std::vector<std::uint8_t>& out) {
+  thread_local const auto sink = std::make_shared<ByteSink<CharT>>();
+  sink->target(out);
+  return sink;
+}
+
+// The serializer allocates its indentation buffer up front, so it and the
+// binary writer are kept alongside the sinks.
+nlohmann::detail::serializer<nlohmann::json>& json_serializer(std::vector<std::uint8_t>& out) {
+  thread_local nlohmann::detail::serializer<nlohmann::json> s(byte_sink<char>(out), ' ');
+  byte_sink<char>(out);
+  return s;
+}
+
+nlohmann::detail::binary_writer<nlohmann::json, std::uint8_t>& binary_writer(
+    std::vector<std::uint8_t>& out) {
+  thread_local nlohmann::detail::binary_writer<nlohmann::json, std::uint8_t> w(
+      byte_sink<std::uint8_t>(out));
+  byte_sink<std::uint8_t>(out);
+  return w;
+}
+
+}  // namespace
+
+DataWriter::DataWriter(std::vector<std::uint8_t>& out, Encoding encoding)
+    : out_(out), encoding_(encoding) {}
+
+void DataWriter::begin_object(std::size_t fields) {
+  open(fields, true);
+}
+
+void DataWriter::end_object() {
+  close('}');
+}
+
+void DataWriter::begin_array(std::size_t size) {
+  open(size, false);
+}
+
+void DataWriter::end_array() {
+  close(']');
+}
+
+void DataWriter::key(std::string_view name) {
+  if (!ok()) return;
+  if (!is_valid_utf8(name.data(), name.size())) {
+    fail("key not valid UTF-8");
+    return;
+  }
+  if (encoding_ == Encoding::Json && depth_ > 0) {
+    const std::uint64_t bit = std::uint64_t{1} << (depth_ - 1);
+    if (has_element_ & bit) out_.push_back(',');
+    has_element_ |= bit;
+  }
+  write_string(name);
+  if (encoding_ == Encoding::Json) out_.push_back(':');
+}
+
+void DataWriter::string(std::string_view value) {
+  if (!before_value()) return;
+  if (!is_valid_utf8(value.data(), value.size())) {
+    fail("string not valid UTF-8");
+    return;
+  }
+  write_string(value);
+}
+
+void DataWriter::integer(std::int64_t value) {
+  scalar(nlohmann::json(value));
+}
+
+void DataWriter::number(std::uint64_t value) {
+  if (!before_value()) return;
+  switch (encoding_) {
+    case Encoding::Json: {
+      char buf[24];
+      char* p = buf + sizeof(buf);
+      do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while (value != 0);
+      out_.insert(out_.end(), p, buf + sizeof(buf));
+      return;
+    }
+    case Encoding::MsgPack:
+      if (value <= 0x7F) {
+        out_.push_back(static_cast<std::uint8_t>(value));
+      } else if (value <= 0xFF) {
+        out_.push_back(0xCC);
+        be(value, 1);
+      } else if (value <= 0xFFFF) {
+        out_.push_back(0xCD);
+        be(value, 2);
+      } else if (value <= 0xFFFFFFFF) {
+        out_.push_back(0xCE);
+        be(value, 4);
+      } else {
+        out_.push_back(0xCF);
+        be(value, 8);
+      }
+      return;
+    case Encoding::Cbor:
+      cbor_head(0, value);
+      return;
+  }
+}
+
+void DataWriter::real(double value) {
+  scalar(nlohmann::json(value));
+}
+
+void DataWriter::boolean(bool value) {
+  scalar(nlohmann::json(value));
+}
+
+void DataWriter::null() {
+  scalar(nlohmann::json());
+}
+
+void DataWriter::value(const nlohmann::json& j) {
+  if (!ok()) return;
+  if (encoding_ == Encoding::Json) {
+    if (!before_value()) return;
+    try {
+      json_serializer(out_).dump(j, false, false, 0);
+    } catch (const nlohmann::json::exception&) {
+      fail("string not valid UTF-8");
+    }
+    return;
+  }
+  // nlohmann's binary writer copies every object key into a temporary json,
+  // so containers are walked here and only scalars handed over. Strings are
+  // checked on the way: binary encodings carry no UTF-8 guarantee.
+  switch (j.type()) {
+    case nlohmann::json::value_t::object:
+      begin_object(j.size());
+      for (auto it = j.begin(); it != j.end(); ++it) {
+        key(it.key());
+        value(it.value());
+      }
+      end_object();
+      return;
+    case nlohmann::json::value_t::array:
+      begin_array(j.size());
+      for (const auto& element : j) value(element);
+      end_array();
+      return;
+    case nlohmann::json::value_t::string:
+      string(j.get_ref<const std::string&>());
+      return;
+    case nlohmann::json::value_t::binary:
+      fail("binary values are not supported");
+      return;
+    default:
+      scalar(j);
+      return;
+  }
+}
+
+void DataWriter::raw_json(std::string_view text) {
+  if (encoding_ == Encoding::Json) {
+    if (!before_value()) return;
+    if (!is_valid_utf8(text.data(), text.size())) {
+      fail("string not valid UTF-8");
+      return;
+    }
+    out_.insert(out_.end(), text.begin(), text.end());
+    return;
+  }
+  auto parsed = nlohmann::json::parse(text, nullptr, false);
+  if (parsed.is_discarded()) {
+    fail("raw JSON malformed");
+    return;
+  }
+  value(parsed);
+}
+
+// Writes the separator owed before a value in an array; object values follow
+// their key directly.
+bool DataWriter::before_value() {
+  if (!ok()) return false;
+  if (encoding_ != Encoding::Json || depth_ == 0) return true;
+  const std::uint64_t bit = std::uint64_t{1} << (depth_ - 1);
+  if (!(in_array_ & bit)) return true;
+  if (has_element_ & bit) out_.push_back(',');
+  has_element_ |= bit;
+  return true;
+}
+
+void DataWriter::open(std::size_t size, bool map) {
+  if (!before_value()) return;
+  if (depth_ == kMaxDepth) {
+    fail("nesting too deep");
+    return;
+  }
+  if (encoding_ == Encoding::Json) {
+    out_.push_back(map ? '{' : '[');
+  } else {
+    container(size, map);
+  }
+  ++depth_;
+  const std::uint64_t bit = std::uint64_t{1} << (depth_ - 1);
+  has_element_ &= ~bit;
+  if (map) {
+    in_array_ &= ~bit;
+  } else {
+    in_array_ |= bit;
+  }
+}
+
+void DataWriter::close(char bracket) {
+  if (!ok() || depth_ == 0) return;
+  --depth_;
+  if (encoding_ == Encoding::Json) out_.push_back(static_cast<std::uint8_t>(bracket));
+}
+
+void DataWriter::scalar(const nlohmann::json& j) {
+  if (!before_value()) return;
+  switch (encoding_) {
+    case Encoding::Json:
+      json_serializer(out_).dump(j, false, false, 0);
+      return;
+    case Encoding::MsgPack:
+      binary_writer(out_).write_msgpack(j);
+      return;
+    case Encoding::Cbor:
+      binary_writer(out_).write_cbor(j);
+      return;
+  }
+}
+
+void DataWriter::write_string(std::string_view value) {
+  switch (encoding_) {
+    case Encoding::Json:
+      json_string(value);
+      return;
+    case Encoding::MsgPack:
+      if (value.size() <= 31) {
+        out_.push_back(static_cast<std::uint8_t>(0xA0 | value.size()));
+      } else if (value.size() <= 0xFF) {
+        out_.push_back(0xD9);
+        be(value.size(), 1);
+      } else if (value.size() <= 0xFFFF) {
+        out_.push_back(0xDA);
+        be(value.size(), 2);
+      } else {
+        out_.push_back(0xDB);
+        be(value.size(), 4);
+      }
+      break;
+    case Encoding::Cbor:
+      cbor_head(3, value.size());
+      break;
+  }
+  out_.insert(out_.end(), value.begin(), value.end());
+}
+
+// Map or array header of a binary encoding.
+void DataWriter::container(std::size_t size, bool map) {
+  if (encoding_ == Encoding::Cbor) {
+    cbor_head(map ? 5 : 4, size);
+  } else if (size <= 15) {
+    out_.push_back(static_cast<std::uint8_t>((map ? 0x80 : 0x90) | size));
+  } else if (size <= 0xFFFF) {
+    out_.push_back(map ? 0xDE : 0xDC);
+    be(size, 2);
+  } else {
+    out_.push_back(map ? 0xDF : 0xDD);
+    be(size, 4);
+  }
+}
+
+void DataWriter::be(std::uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out_.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+  }
+}
+
+void DataWriter::cbor_head(std::uint8_t major, std::uint64_t value) {
+  const auto type = static_cast<std::uint8_t>(major << 5);
+  if (value <= 0x17) {
+    out_.push_back(static_cast<std::uint8_t>(type | value));
+  } else if (value <= 0xFF) {
+    out_.push_back(type | 0x18);
+    be(value, 1);
+  } else if (value <= 0xFFFF) {
+    out_.push_back(type | 0x19);
+    be(value, 2);
+  } else if (value <= 0xFFFFFFFF) {
+    out_.push_back(type | 0x1A);
+    be(value, 4);
+  } else {
+    out_.push_back(type | 0x1B);
+    be(value, 8);
+  }
+}
+
+// Same escaping as nlohmann's dump: short forms where JSON has them, \u00xx
+// for other control characters, everything else verbatim.
+void DataWriter::json_string(std::string_view value) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  out_.push_back('"');
+  for (char ch : value) {
+    const auto c = static_cast<unsigned char>(ch);
+    const char* escape = nullptr;
+    switch (c) {
+      case '"': escape = "\\\""; break;
+      case '\\': escape = "\\\\"; break;
+      case '\b': escape = "\\b"; break;
+      case '\f': escape = "\\f"; break;
+      case '\n': escape = "\\n"; break;
+      case '\r': escape = "\\r"; break;
+      case '\t': escape = "\\t"; break;
+      default: break;
+    }
+    if (escape) {
+      out_.insert(out_.end(), escape, escape + 2);
+    } else if (c < 0x20) {
+      const char u[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF]};
+      out_.insert(out_.end(), u, u + sizeof(u));
+    } else {
+      out_.push_back(c);
+    }
+  }
+  out_.push_back('"');
+}
+
+void DataWriter::fail(const char* what) {
+  if (ok()) error_ = what;
+}
+
+}  // namespace quiz
@@ -0,0 +1,130 @@
+#include "common/utf8.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#include "utf8_simd.hpp"
+
+namespace quiz {
+namespace {
+
+// Byte-at-a-time validation following the well-formed sequence table of the
+// Unicode standard (Table 3-7). Runs of ASCII are skipped eight bytes at a
+// time.
+bool validate_scalar(const std::uint8_t* s, std::size_t len) {
+  std::size_t i = 0;
+  while (i < len) {
+    if (i + 8 <= len) {
+      std::uint64_t word;
+      std::memcpy(&word, s + i, sizeof(word));
+      if ((word & 0x8080808080808080ull) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    const std::uint8_t c = s[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    std::size_t need = 0;
+    std::uint8_t lo = 0x80;  // allowed range of the second byte
+    std::uint8_t hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      need = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      need = 2;
+      if (c == 0xE0) lo = 0xA0;  // overlong
+      if (c == 0xED) hi = 0x9F;  // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      need = 3;
+      if (c == 0xF0) lo = 0x90;  // overlong
+      if (c == 0xF4) hi = 0x8F;  // above U+10FFFF
+    } else {
+      return false;  // continuation byte, C0/C1 or F5..FF as lead
+    }
+    if (len - i <= need) return false;
+    if (s[i + 1] < lo || s[i + 1] > hi) return false;
+    for (std::size_t j = 2; j <= need; ++j) {
+      if ((s[i + j] & 0xC0) != 0x80) return false;
+    }
+    i += need + 1;
+  }
+  return true;
+}
+
+using Kernel = bool (*)(const std::uint8_t*, std::size_t);
+
+Kernel kernel_for(Utf8Impl impl) {
+  switch (impl) {
+#ifdef QUIZ_UTF8_SIMD
+    case Utf8Impl::Avx2:
+      return detail::validate_utf8_avx2;
+    case Utf8Impl::Sse4:
+      return detail::validate_utf8_sse4;
+#endif
+    default:
+      return validate_scalar;
+  }
+}
+
+Utf8Impl detect_impl() {
+  if (utf8_impl_available(Utf8Impl::Avx2)) return Utf8Impl::Avx2;
+  if (utf8_impl_available(Utf8Impl::Sse4)) return Utf8Impl::Sse4;
+  return Utf8Impl::Scalar;
+}
+
+Kernel active_kernel() {
+  static const Kernel kernel = kernel_for(active_utf8_impl());
+  return kernel;
+}
+
+}  // namespace
+
+std::string to_string(Utf8Impl impl) {
+  switch (impl) {
+    case Utf8Impl::Scalar:
+      return "scalar";
+    case Utf8Impl::Sse4:
+      return "sse4";
+    case Utf8Impl::Avx2:
+      return "avx2";
+  }
+  return "scalar";
+}
+
+bool utf8_impl_available(Utf8Impl impl) {
+  switch (impl) {
+    case Utf8Impl::Scalar:
+      return true;
+#ifdef QUIZ_UTF8_SIMD
+    case Utf8Impl::Sse4:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse4.2");
+    case Utf8Impl::Avx2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+Utf8Impl active_utf8_impl() {
+  static const Utf8Impl impl = detect_impl();
+  return impl;
+}
+
+bool is_valid_utf8(const void* data, std::size_t len) {
+  return active_kernel()(static_cast<const std::uint8_t*>(data), len);
+}
+
+bool is_valid_utf8(const std::string& s) {
+  return is_valid_utf8(s.data(), s.size());
+}
+
+bool is_valid_utf8_with(Utf8Impl impl, const void* data, std::size_t len) {
+  return kernel_for(impl)(static_cast<const std::uint8_t*>(data), len);
+}
+
+}  // namespace quiz
@@ -0,0 +1,45 @@
+// Built with -mavx2; only reached after a runtime CPU check.
+#include <immintrin.h>
+
+#include "utf8_simd.hpp"
+
+namespace quiz::detail {
+namespace {
+
+struct Avx2 {
+  using V = __m256i;
+  static constexpr std::size_t kWidth = 32;
+
+  static V load(const std::uint8_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const V*>(p));
+  }
+  static V table(const std::uint8_t* t) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t)));
+  }
+  static V zero() { return _mm256_setzero_si256(); }
+  static V splat(std::uint8_t n) { return _mm256_set1_epi8(static_cast<char>(n)); }
+  static bool is_ascii(V v) { return _mm256_movemask_epi8(v) == 0; }
+  static bool any(V v) { return !_mm256_testz_si256(v, v); }
+  static V lookup(V table, V idx) { return _mm256_shuffle_epi8(table, idx); }
+  static V high_nibble(V v) { return _mm256_and_si256(_mm256_srli_epi16(v, 4), splat(0x0F)); }
+  static V low_nibble(V v) { return _mm256_and_si256(v, splat(0x0F)); }
+  // alignr shifts within 128-bit lanes, so splice the lanes first.
+  template <int N>
+  static V prev(V input, V prev_input) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21),
+                              16 - N);
+  }
+  static V sat_sub(V v, std::uint8_t n) { return _mm256_subs_epu8(v, splat(n)); }
+  static V and_(V a, V b) { return _mm256_and_si256(a, b); }
+  static V or_(V a, V b) { return _mm256_or_si256(a, b); }
+  static V xor_(V a, V b) { return _mm256_xor_si256(a, b); }
+  static V incomplete(V input) { return _mm256_subs_epu8(input, load(utf8::kIncompleteMax)); }
+};
+
+}  // namespace
+
+bool validate_utf8_avx2(const std::uint8_t* s, std::size_t len) {
+  return utf8::validate<Avx2>(s, len);
+}
+
+}  // namespace quiz::detail
@@ -0,0 +1,125 @@
+#pragma once
+
+// Vector UTF-8 validation shared by the per-ISA translation units
+// (utf8_sse4.cpp, utf8_avx2.cpp), which are compiled with their own -m
+// flags and only called after a runtime CPU check.
+//
+// The kernel is the lookup-table method of Keiser and Lemire ("Validating
+// UTF-8 In Less Than One Instruction Per Byte", 2021): three 16-entry tables
+// indexed by nibbles of the previous and current byte flag every invalid
+// two-byte pattern (overlongs, surrogates, > U+10FFFF, stray or missing
+// continuations), and a second check makes sure the 3rd and 4th bytes of
+// long sequences are continuations.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace quiz::detail {
+
+bool validate_utf8_sse4(const std::uint8_t* s, std::size_t len);
+bool validate_utf8_avx2(const std::uint8_t* s, std::size_t len);
+
+namespace utf8 {
+
+constexpr std::uint8_t kTooShort = 1 << 0;
+constexpr std::uint8_t kTooLong = 1 << 1;
+constexpr std::uint8_t kOverlong3 = 1 << 2;
+constexpr std::uint8_t kTooLarge = 1 << 3;
+constexpr std::uint8_t kSurrogate = 1 << 4;
+constexpr std::uint8_t kOverlong2 = 1 << 5;
+constexpr std::uint8_t kTooLarge1000 = 1 << 6;
+constexpr std::uint8_t kOverlong4 = 1 << 6;
+constexpr std::uint8_t kTwoConts = 1 << 7;
+constexpr std::uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// High nibble of the previous byte.
+alignas(16) inline constexpr std::uint8_t kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4};
+
+// Low nibble of the previous byte.
+alignas(16) inline constexpr std::uint8_t kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000};
+
+// High nibble of the current byte.
+alignas(16) inline constexpr std::uint8_t kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort};
+
+// Largest byte allowed in each of the last positions of a vector; a lead byte
+// above it needs input beyond the vector. Wider vectors use the tail.
+alignas(32) inline constexpr std::uint8_t kIncompleteMax[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+
+// `S` wraps one instruction set: a vector type V, its width, and the handful
+// of byte operations the kernel needs.
+template <typename S>
+bool validate(const std::uint8_t* s, std::size_t len) {
+  using V = typename S::V;
+  const V byte1_high = S::table(kByte1High);
+  const V byte1_low = S::table(kByte1Low);
+  const V byte2_high = S::table(kByte2High);
+  V error = S::zero();
+  V prev_input = S::zero();
+  V prev_incomplete = S::zero();
+
+  auto block = [&](V input) {
+    if (S::is_ascii(input)) {
+      // A sequence cut off at the end of the previous vector is an error.
+      error = S::or_(error, prev_incomplete);
+    } else {
+      V prev1 = S::template prev<1>(input, prev_input);
+      V special = S::and_(S::and_(S::lookup(byte1_high, S::high_nibble(prev1)),
+                                  S::lookup(byte1_low, S::low_nibble(prev1))),
+                          S::lookup(byte2_high, S::high_nibble(input)));
+      // Only bytes two after a 3/4-byte lead or three after a 4-byte lead
+      // end up >= 0x80; those must be the continuations the table flagged.
+      V is_third = S::sat_sub(S::template prev<2>(input, prev_input), 0xE0 - 0x80);
+      V is_fourth = S::sat_sub(S::template prev<3>(input, prev_input), 0xF0 - 0x80);
+      V must23 = S::and_(S::or_(is_third, is_fourth), S::splat(0x80));
+      error = S::or_(error, S::xor_(must23, special));
+      prev_incomplete = S::incomplete(input);
+    }
+    prev_input = input;
+  };
+
+  std::size_t i = 0;
+  for (; i + S::kWidth <= len; i += S::kWidth) block(S::load(s + i));
+  if (i < len) {
+    // Zero padding reads as ASCII, which also flags a truncated tail.
+    alignas(32) std::uint8_t tail[S::kWidth] = {};
+    std::memcpy(tail, s + i, len - i);
+    block(S::load(tail));
+  }
+  error = S::or_(error, prev_incomplete);
+  return !S::any(error);
+}
+
+}  // namespace utf8
+}  // namespace quiz::detail
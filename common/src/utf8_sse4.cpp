@@ -0,0 +1,39 @@
+// Built with -msse4.2; only reached after a runtime CPU check.
+#include <immintrin.h>
+
+#include "utf8_simd.hpp"
+
+namespace quiz::detail {
+namespace {
+
+struct Sse4 {
+  using V = __m128i;
+  static constexpr std::size_t kWidth = 16;
+
+  static V load(const std::uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const V*>(p)); }
+  static V table(const std::uint8_t* t) { return load(t); }
+  static V zero() { return _mm_setzero_si128(); }
+  static V splat(std::uint8_t n) { return _mm_set1_epi8(static_cast<char>(n)); }
+  static bool is_ascii(V v) { return _mm_movemask_epi8(v) == 0; }
+  static bool any(V v) { return !_mm_testz_si128(v, v); }
+  static V lookup(V table, V idx) { return _mm_shuffle_epi8(table, idx); }
+  static V high_nibble(V v) { return _mm_and_si128(_mm_srli_epi16(v, 4), splat(0x0F)); }
+  static V low_nibble(V v) { return _mm_and_si128(v, splat(0x0F)); }
+  template <int N>
+  static V prev(V input, V prev_input) {
+    return _mm_alignr_epi8(input, prev_input, 16 - N);
+  }
+  static V sat_sub(V v, std::uint8_t n) { return _mm_subs_epu8(v, splat(n)); }
+  static V and_(V a, V b) { return _mm_and_si128(a, b); }
+  static V or_(V a, V b) { return _mm_or_si128(a, b); }
+  static V xor_(V a, V b) { return _mm_xor_si128(a, b); }
+  static V incomplete(V input) { return _mm_subs_epu8(input, load(utf8::kIncompleteMax + 16)); }
+};
+
+}  // namespace
+
+bool validate_utf8_sse4(const std::uint8_t* s, std::size_t len) {
+  return utf8::validate<Sse4>(s, len);
+}
+
+}  // namespace quiz::detail
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <openssl/crypto.h>
+
+#include "common/aes_crypto.hpp"
+#include "common/codec.hpp"
+#include "common/utf8.hpp"
+
+// Allocation accounting: every operator new in the process and everything
+// OpenSSL allocates (hooked in main). zlib's stream state is per thread and
+// allocated once, so it does not show up per operation.
+namespace {
+std::atomic<std::size_t> g_allocs{0};
+std::atomic<std::size_t> g_alloc_bytes{0};
+
+void count_alloc(std::size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* openssl_malloc(std::size_t size, const char*, int) {
+  count_alloc(size);
+  return std::malloc(size);
+}
+
+void* openssl_realloc(void* ptr, std::size_t size, const char*, int) {
+  count_alloc(size);
+  return std::realloc(ptr, size);
+}
+
+void openssl_free(void* ptr, const char*, int) { std::free(ptr); }
+}  // namespace
+
+void* operator new(std::size_t size) {
+  count_alloc(size);
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+// Runs `fn` until at least `min_time` has passed and prints the per-call
+// cost: time, throughput over `bytes`, and heap allocations (count and
+// bytes requested).
+void bench(const std::string& name, std::size_t bytes, const std::function<void()>& fn,
+           std::chrono::milliseconds min_time = std::chrono::milliseconds(300)) {
+  fn();  // warm up
+  std::size_t iterations = 0;
+  const std::size_t allocs_before = g_allocs.load();
+  const std::size_t alloc_bytes_before = g_alloc_bytes.load();
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed{};
+  do {
+    for (int i = 0; i < 16; ++i) fn();
+    iterations += 16;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < min_time);
+  const double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  const double allocs = static_cast<double>(g_allocs.load() - allocs_before) / iterations;
+  const double alloc_bytes =
+      static_cast<double>(g_alloc_bytes.load() - alloc_bytes_before) / iterations;
+  std::printf("%-44s %12.0f ns/op %9.1f MB/s %8.1f allocs/op %10.0f B/op\n", name.c_str(), ns,
+              ns > 0 ? bytes / ns * 1e3 : 0.0, allocs, alloc_bytes);
+}
+
+// Roughly what exam papers and results look like on the wire.
+std::string json_like(std::size_t size, const std::string& text) {
+  std::string out = "{\"questions\":[";
+  while (out.size() < size) {
+    out += "{\"question_id\":123456,\"content\":\"" + text + "\",\"options\":{\"A\":\"" +
+           text + "\",\"B\":\"2\"}},";
+  }
+  out.resize(size);
+  return out;
+}
+
+void bench_utf8() {
+  const std::vector<std::pair<std::string, std::string>> inputs = {
+      {"ascii 256B", json_like(256, "What is the capital of France?")},
+      {"ascii 900KB", json_like(900'000, "What is the capital of France?")},
+      {"vietnamese 256B", json_like(256, "Thủ đô của nước Pháp là gì?")},
+      {"vietnamese 900KB", json_like(900'000, "Thủ đô của nước Pháp là gì?")},
+  };
+  for (auto impl : {quiz::Utf8Impl::Scalar, quiz::Utf8Impl::Sse4, quiz::Utf8Impl::Avx2}) {
+    if (!quiz::utf8_impl_available(impl)) continue;
+    for (const auto& [label, input] : inputs) {
+      // json_like may cut a multi-byte character; the kernels must still
+      // scan the whole buffer to reject it, so the timing is unaffected.
+      bench("utf8/" + quiz::to_string(impl) + "/" + label, input.size(), [&, impl] {
+        volatile bool ok = quiz::is_valid_utf8_with(impl, input.data(), input.size());
+        (void)ok;
+      });
+    }
+  }
+}
+
+// Messages shaped like real traffic (see scripts/dict_samples).
+struct Shape {
+  std::string name;
+  quiz::Message msg;
+};
+
+quiz::Message request(const std::string& action, nlohmann::json data) {
+  quiz::Message msg;
+  msg.action = action;
+  msg.timestamp = 1760000000;
+  msg.session_id = "d50fec9bb7c74a2fdcde1ff910dc8285";
+  msg.data = std::move(data);
+  return msg;
+}
+
+std::vector<Shape> shapes() {
+  std::vector<Shape> out;
+
+  auto login = request("LOGIN", {{"username", "student1"}, {"password", "student123"}});
+  login.session_id.clear();
+  out.push_back({"login", login});
+
+  out.push_back({"submit_answer",
+                 request("SUBMIT_ANSWER",
+                         {{"exam_id", 1},
+                          {"answers", {{{"question_id", 46}, {"selected_option", "B"}}}}})});
+
+  nlohmann::json questions = nlohmann::json::array();
+  for (int i = 0; i < 50; ++i) {
+    questions.push_back({{"question_id", 100 + i},
+                         {"question_text", "Which layer of the OSI model handles routing? (" +
+                                               std::to_string(i) + ")"},
+                         {"options",
+                          {{"A", "Network"}, {"B", "Transport"}, {"C", "Data link"},
+                           {"D", "Session"}}},
+                         {"topic", i % 2 ? "IP" : "TCP"},
+                         {"difficulty", i % 3 ? "MEDIUM" : "EASY"}});
+  }
+  auto paper = request("GET_EXAM_PAPER", {{"exam_id", 1},
+                                          {"room_id", 7},
+                                          {"start_time", 1792321362},
+                                          {"end_time", 1792324962},
+                                          {"questions", questions}});
+  paper.type = quiz::MessageType::Response;
+  paper.status = quiz::Status::Success;
+  out.push_back({"exam_paper_50q", paper});
+
+  // Base64-like text: incompressible enough to stand in for an attachment.
+  static constexpr char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string blob(1'000'000, 'A');
+  std::uint32_t x = 12345;
+  for (auto& c : blob) {
+    x = x * 1664525u + 1013904223u;
+    c = kAlphabet[x >> 26];
+  }
+  out.push_back({"blob_1mb", request("UPLOAD", {{"blob", blob}})});
+  return out;
+}
+
+constexpr quiz::Encoding kEncodings[] = {quiz::Encoding::Json, quiz::Encoding::MsgPack,
+                                         quiz::Encoding::Cbor};
+
+quiz::FrameHeader v2_header(quiz::Encoding encoding, std::uint8_t flags = 0) {
+  quiz::FrameHeader header;
+  header.version = quiz::kProtocolV2;
+  header.encoding = encoding;
+  header.flags = flags;
+  return header;
+}
+
+void bench_codec(const std::vector<Shape>& inputs) {
+  // Any key will do; every GCM frame here reuses number 1.
+  const quiz::GcmKeys keys;
+  const quiz::GcmFrameKey gcm{keys.send, 1};
+  for (const auto& shape : inputs) {
+    for (auto [encoding, flags] : {std::pair{quiz::Encoding::Json, std::uint8_t{0}},
+                                   std::pair{quiz::Encoding::MsgPack, std::uint8_t{0}},
+                                   std::pair{quiz::Encoding::Cbor, std::uint8_t{0}},
+                                   std::pair{quiz::Encoding::MsgPack, quiz::kFrameFlagGcm},
+                                   std::pair{quiz::Encoding::MsgPack, quiz::kFrameFlagPlaintext}}) {
+      const auto header = v2_header(encoding, flags);
+      const char* cipher = flags & quiz::kFrameFlagGcm         ? "+GCM/"
+                           : flags & quiz::kFrameFlagPlaintext ? "+NONE/"
+                                                               : "/";
+      const std::string suffix = "/" + quiz::to_string(encoding) + cipher + shape.name;
+      std::string error;
+      std::vector<std::uint8_t> frame;
+      if (!quiz::encode_frame_into(shape.msg, header, frame, error, &gcm)) {
+        std::printf("%s: encode failed: %s\n", suffix.c_str(), error.c_str());
+        continue;
+      }
+      bench("encode" + suffix, frame.size(), [&] {
+        std::string err;
+        std::vector<std::uint8_t> fresh;
+        volatile bool ok = quiz::encode_frame_into(shape.msg, header, fresh, err, &gcm);
+        (void)ok;
+      });
+      std::vector<std::uint8_t> reused;
+      bench("encode_into" + suffix, frame.size(), [&] {
+        std::string err;
+        quiz::encode_frame_into(shape.msg, header, reused, err, &gcm);
+      });
+      bench("decode" + suffix, frame.size(), [&] {
+        quiz::Message out;
+        quiz::FrameHeader got;
+        std::string err;
+        volatile bool ok = quiz::decode_frame(frame, out, got, err, &gcm);
+        (void)ok;
+      });
+      if (encoding == quiz::Encoding::Json) {
+        bench("decode_envelope" + suffix, frame.size(), [&] {
+          quiz::Message out;
+          quiz::FrameHeader got;
+          std::string err;
+          volatile bool ok = quiz::decode_frame_envelope(frame, out, got, err, &gcm);
+          (void)ok;
+        });
+      }
+    }
+  }
+}
+
+void bench_crypto(const std::vector<Shape>& inputs) {
+  for (const auto& shape : inputs) {
+    const std::string plain = quiz::message_to_json(shape.msg).dump();
+    const auto* bytes = reinterpret_cast<const std::uint8_t*>(plain.data());
+    std::string error;
+    const auto cipher = quiz::encrypt_aes_cbc(bytes, plain.size(), error);
+    bench("encrypt/" + shape.name, plain.size(), [&] {
+      std::string err;
+      volatile auto size = quiz::encrypt_aes_cbc(bytes, plain.size(), err).size();
+      (void)size;
+    });
+    bench("decrypt/" + shape.name, cipher.size(), [&] {
+      std::string err;
+      volatile auto size = quiz::decrypt_aes_cbc(cipher.data(), cipher.size(), err).size();
+      (void)size;
+    });
+    // The forms the codec uses: one buffer reused across frames.
+    std::vector<std::uint8_t> buffer;
+    bench("encrypt_in_place/" + shape.name, plain.size(), [&] {
+      std::string err;
+      buffer.assign(bytes, bytes + plain.size());
+      volatile bool ok = quiz::encrypt_aes_cbc_in_place(buffer, 0, err);
+      (void)ok;
+    });
+    bench("decrypt_into/" + shape.name, cipher.size(), [&] {
+      std::string err;
+      volatile bool ok = quiz::decrypt_aes_cbc_into(cipher.data(), cipher.size(), buffer, err);
+      (void)ok;
+    });
+    bench("decrypt_in_place/" + shape.name, cipher.size(), [&] {
+      std::string err;
+      buffer.assign(cipher.begin(), cipher.end());
+      volatile bool ok = quiz::decrypt_aes_cbc_in_place(buffer, 0, err);
+      (void)ok;
+    });
+    // Room for the nonce, then the plaintext.
+    std::vector<std::uint8_t> unsealed(quiz::kGcmNonceBytes + plain.size());
+    std::copy(plain.begin(), plain.end(), unsealed.begin() + quiz::kGcmNonceBytes);
+    auto sealed = unsealed;
+    const quiz::GcmKeys keys;
+    quiz::encrypt_aes_gcm_in_place(sealed, quiz::kGcmNonceBytes, keys.send, 1, nullptr, 0,
+                                   error);
+    bench("gcm_encrypt_in_place/" + shape.name, plain.size(), [&] {
+      std::string err;
+      buffer = unsealed;
+      volatile bool ok = quiz::encrypt_aes_gcm_in_place(buffer, quiz::kGcmNonceBytes, keys.send,
+                                                        1, nullptr, 0, err);
+      (void)ok;
+    });
+    bench("gcm_decrypt_into/" + shape.name, sealed.size(), [&] {
+      std::string err;
+      volatile bool ok = quiz::decrypt_aes_gcm_into(sealed.data(), sealed.size(), keys.send, 1,
+                                                    nullptr, 0, buffer, err);
+      (void)ok;
+    });
+    bench("utf8/" + quiz::to_string(quiz::active_utf8_impl()) + "/" + shape.name, plain.size(),
+          [&] {
+            volatile bool ok = quiz::is_valid_utf8(plain);
+            (void)ok;
+          });
+  }
+}
+
+void print_wire_sizes(const std::vector<Shape>& inputs) {
+  std::printf("\n%-20s %10s %10s %10s %10s %14s\n", "wire bytes", "v1", "JSON", "MSGPACK",
+              "CBOR", "JSON+DEFLATE");
+  for (const auto& shape : inputs) {
+    std::string error;
+    std::printf("%-20s %10zu", shape.name.c_str(),
+                quiz::encode_frame(shape.msg, error).size());
+    for (auto encoding : kEncodings) {
+      std::printf(" %10zu", quiz::encode_frame(shape.msg, v2_header(encoding), error).size());
+    }
+    std::printf(" %14zu\n",
+                quiz::encode_frame(shape.msg,
+                                   v2_header(quiz::Encoding::Json, quiz::kFrameFlagDeflate), error)
+                    .size());
+  }
+}
+
+}  // namespace
+
+// Usage: codec_bench [utf8|codec|crypto|sizes]
+int main(int argc, char** argv) {
+  CRYPTO_set_mem_functions(openssl_malloc, openssl_realloc, openssl_free);
+  const std::string only = argc > 1 ? argv[1] : "";
+  std::printf("utf8 dispatch: %s\n", quiz::to_string(quiz::active_utf8_impl()).c_str());
+  const auto inputs = shapes();
+  if (only.empty() || only == "utf8") bench_utf8();
+  if (only.empty() || only == "codec") bench_codec(inputs);
+  if (only.empty() || only == "crypto") bench_crypto(inputs);
+  if (only.empty() || only == "sizes") print_wire_sizes(inputs);
+  return 0;
+}
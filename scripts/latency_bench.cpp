@@ -0,0 +1,118 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/codec.hpp"
+
+using quiz::Message;
+using quiz::MessageType;
+using quiz::Status;
+
+namespace {
+
+int connect_to(const std::string& host, uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+double percentile_us(const std::vector<std::uint64_t>& sorted_ns, double p) {
+  if (sorted_ns.empty()) return 0.0;
+  std::size_t idx = static_cast<std::size_t>(p * (sorted_ns.size() - 1));
+  return sorted_ns[idx] / 1000.0;
+}
+
+}  // namespace
+
+// Closed-loop ECHO latency benchmark: every connection sends one request,
+// waits for the answer, and repeats. Run it against a server started with
+// and without QUIZ_REACTOR_CPUS / QUIZ_WORKER_CPUS to compare tail latency.
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <host> <port> [connections=8] [requests=2000] [payload_bytes=64]\n";
+    return 1;
+  }
+  std::string host = argv[1];
+  uint16_t port = static_cast<uint16_t>(std::stoi(argv[2]));
+  int connections = argc > 3 ? std::max(1, std::stoi(argv[3])) : 8;
+  int requests = argc > 4 ? std::max(1, std::stoi(argv[4])) : 2000;
+  std::size_t payload = argc > 5 ? static_cast<std::size_t>(std::stoul(argv[5])) : 64;
+
+  std::mutex mtx;
+  std::vector<std::uint64_t> samples;
+  samples.reserve(static_cast<std::size_t>(connections) * requests);
+  std::size_t failures = 0;
+
+  auto started = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int c = 0; c < connections; ++c) {
+    threads.emplace_back([&] {
+      std::vector<std::uint64_t> local;
+      local.reserve(requests);
+      std::size_t failed = 0;
+      int fd = connect_to(host, port);
+      if (fd < 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        failures += requests;
+        return;
+      }
+      Message req;
+      req.type = MessageType::Request;
+      req.action = "ECHO";
+      req.data = {{"msg", std::string(payload, 'x')}};
+      std::string err;
+      std::vector<std::uint8_t> resp_frame;
+      for (int i = 0; i < requests; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto frame = quiz::encode_frame(req, err);
+        Message resp;
+        if (frame.empty() || !quiz::write_frame(fd, frame, err) ||
+            !quiz::read_frame(fd, resp_frame, err) ||
+            !quiz::decode_frame(resp_frame, resp, err) || resp.status != Status::Success) {
+          ++failed;
+          break;
+        }
+        local.push_back(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0)
+                .count()));
+      }
+      ::close(fd);
+      std::lock_guard<std::mutex> lock(mtx);
+      samples.insert(samples.end(), local.begin(), local.end());
+      failures += failed;
+    });
+  }
+  for (auto& t : threads) t.join();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  std::sort(samples.begin(), samples.end());
+  std::cout << "requests: " << samples.size() << " ok, " << failures << " failed in " << secs
+            << " s (" << (secs > 0 ? samples.size() / secs : 0.0) << " req/s)\n"
+            << "latency us: p50 " << percentile_us(samples, 0.50) << "  p90 "
+            << percentile_us(samples, 0.90) << "  p99 " << percentile_us(samples, 0.99)
+            << "  p99.9 " << percentile_us(samples, 0.999) << "  max "
+            << (samples.empty() ? 0.0 : samples.back() / 1000.0) << "\n";
+  return failures == 0 ? 0 : 1;
+}
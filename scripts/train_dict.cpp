@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Builds the preset deflate dictionary from captured protocol messages
+// (one serialized envelope per file, e.g. scripts/dict_samples/*.json).
+//
+// zlib can copy from the dictionary like from earlier output, so the
+// dictionary is a concatenation of the fragments that recur across
+// messages: keys with the punctuation around them and short string values
+// such as statuses and option labels. Fragments are ordered by estimated
+// savings, most valuable last, because deflate encodes nearer matches
+// with shorter distances.
+//
+// Usage: train_dict <out.inc> <sample>...
+// Regenerate common/src/deflate_dictionary.inc whenever message shapes change;
+// peers only use compression when their dictionary ids match.
+
+namespace {
+
+constexpr std::size_t kMaxDictionary = 32 * 1024;  // deflate window
+constexpr std::size_t kMaxValueLength = 32;         // longer strings are data, not protocol
+
+// Returns one past the closing quote of the string starting at text[i].
+std::size_t string_end(const std::string& text, std::size_t i) {
+  for (++i; i < text.size(); ++i) {
+    if (text[i] == '\\') {
+      ++i;
+    } else if (text[i] == '"') {
+      return i + 1;
+    }
+  }
+  return text.size();
+}
+
+// Session tokens, room codes and the like differ in every message.
+bool looks_like_id(const std::string& value) {
+  return std::count_if(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; }) >= 6;
+}
+
+void collect(const std::string& text, std::map<std::string, std::size_t>& counts) {
+  std::size_t i = 0;
+  while (i < text.size()) {
+    if (text[i] != '"') {
+      ++i;
+      continue;
+    }
+    const std::size_t end = string_end(text, i);
+    const bool is_key = end < text.size() && text[end] == ':';
+    if (is_key) {
+      // Keep the separator before and the opening of the value after.
+      std::size_t from = i > 0 ? i - 1 : i;
+      std::size_t to = end + 1;
+      if (to < text.size() && (text[to] == '{' || text[to] == '[' || text[to] == '"')) ++to;
+      ++counts[text.substr(from, to - from)];
+    } else if (end - i <= kMaxValueLength + 2) {
+      std::string value = text.substr(i, end - i);
+      if (!looks_like_id(value)) ++counts[value];
+    }
+    i = end;
+  }
+}
+
+void write_literal(std::ostream& out, const std::string& dict) {
+  constexpr std::size_t kLine = 72;
+  std::string line;
+  for (unsigned char c : dict) {
+    if (c == '"' || c == '\\') {
+      line += '\\';
+      line += static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7F) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\%03o", c);
+      line += buf;
+    } else {
+      line += static_cast<char>(c);
+    }
+    if (line.size() >= kLine) {
+      out << "\"" << line << "\"\n";
+      line.clear();
+    }
+  }
+  if (!line.empty()) out << "\"" << line << "\"\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <out.inc> <sample>...\n";
+    return 1;
+  }
+  std::map<std::string, std::size_t> counts;
+  for (int i = 2; i < argc; ++i) {
+    std::ifstream in(argv[i], std::ios::binary);
+    if (!in) {
+      std::cerr << "cannot read " << argv[i] << "\n";
+      return 1;
+    }
+    std::stringstream buf;
+    buf << in.rdbuf();
+    collect(buf.str(), counts);
+  }
+
+  // Savings estimate: every repeat beyond the first could become a match,
+  // and a match costs about three bytes.
+  std::vector<std::pair<std::size_t, std::string>> ranked;
+  for (const auto& [fragment, count] : counts) {
+    if (count < 2 || fragment.size() <= 3) continue;
+    ranked.emplace_back(count * (fragment.size() - 3), fragment);
+  }
+  std::sort(ranked.begin(), ranked.end());
+
+  std::string dict;
+  for (auto it = ranked.rbegin(); it != ranked.rend(); ++it) {
+    if (dict.size() + it->second.size() > kMaxDictionary) break;
+    dict.insert(0, it->second);
+  }
+
+  std::ofstream out(argv[1]);
+  out << "// Generated by scripts/train_dict from " << (argc - 2)
+      << " protocol samples; do not edit.\n";
+  write_literal(out, dict);
+  std::cout << "dictionary: " << dict.size() << " bytes from " << ranked.size()
+            << " fragments\n";
+  return 0;
+}
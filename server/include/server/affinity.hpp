@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace quiz::server {
+
+// Parses a Linux-style CPU list such as "0-3,8,10-11" into core ids.
+bool parse_cpu_list(const std::string& spec, std::vector<int>& out, std::string* error);
+
+// Pins the calling thread to `cpu` and makes its allocations prefer that
+// core's NUMA node, so buffers first touched on the thread stay local.
+// Returns false (and leaves the thread unpinned) if the core is unusable.
+bool pin_current_thread(int cpu, std::string* error);
+
+// NUMA node of `cpu`, or -1 when the machine or build has no NUMA support.
+int numa_node_of_cpu(int cpu);
+
+}  // namespace quiz::server
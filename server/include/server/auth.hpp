@@ -1,13 +1,24 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <nlohmann/json.hpp>
 #include <sqlite3.h>
 
 #include "common/message.hpp"
+#include "server/stage.hpp"
 
 namespace quiz::server {
 
@@ -19,9 +30,52 @@ struct SessionInfo {
   std::uint64_t expires_at{};
 };
 
+// Session tokens that carry their own claims:
+//   st1.<key id>.<user_id>.<expires_at>.<role>.<username hex>.<HMAC-SHA256 hex>
+// Checking one costs an HMAC and no database access. Keys are random, held
+// in memory only and replaced every `rotation`; a key is kept until the last
+// token it signed has expired, so a restart ends every signed session.
+// Revoked tokens are remembered, also in memory, until they would expire.
+class SessionSigner {
+ public:
+  explicit SessionSigner(std::chrono::seconds rotation);
+
+  static bool is_signed(const std::string& token);
+
+  // Token for `session`, whose token field is ignored.
+  std::string issue(const SessionInfo& session);
+  std::optional<SessionInfo> verify(const std::string& token, std::string* error = nullptr);
+  void revoke(const std::string& token);
+
+  nlohmann::json stats();
+
+ private:
+  struct Key {
+    std::uint8_t secret[32];
+    std::chrono::steady_clock::time_point created;
+    std::uint64_t last_expiry{};  // latest expires_at signed with it
+  };
+
+  // Hex HMAC-SHA256 of `signed_part`; empty if OpenSSL fails.
+  std::string mac(const Key& key, std::string_view signed_part) const;
+
+  const std::chrono::seconds rotation_;
+  std::shared_mutex mtx_;
+  std::map<std::uint32_t, Key> keys_;
+  std::uint32_t current_{0};  // 0 until the first token is issued
+  std::unordered_map<std::string, std::uint64_t> revoked_;  // MAC -> expires_at
+  std::atomic<std::uint64_t> issued_{0};
+  std::atomic<std::uint64_t> verified_{0};
+  std::atomic<std::uint64_t> rejected_{0};
+};
+
+// login and register_user hash the password, which is deliberately slow, so
+// callers run them on the service's password stage through submit:
+// `hash_threads` threads bound the CPU and memory logins may take, and no
+// more than `hash_queue` wait. Session checks never hash and stay fast.
 class AuthService {
  public:
-  explicit AuthService(std::string db_path);
+  AuthService(std::string db_path, std::size_t hash_threads = 2, std::size_t hash_queue = 32);
   ~AuthService();
 
   AuthService(const AuthService&) = delete;
@@ -43,6 +97,16 @@ class AuthService {
 
   std::optional<SessionInfo> validate(const std::string& token, std::string* error = nullptr);
 
+  // From now on login hands out signed tokens, which validate and logout
+  // handle without the database; tokens stored in sessions keep working.
+  // Call before serving requests.
+  void enable_signed_tokens(std::chrono::seconds key_rotation);
+
+  // Queues work on the password stage; false when the queue is full.
+  bool submit(std::function<void()> job);
+  // Figures of the password stage and of signed tokens.
+  nlohmann::json stats();
+
  private:
   bool open_db();
   std::string random_token();
@@ -50,6 +114,8 @@ class AuthService {
   std::string db_path_;
   sqlite3* db_{nullptr};
   std::mutex mtx_;
+  std::unique_ptr<SessionSigner> signer_;
+  Stage hash_stage_;
 };
 
 }  // namespace quiz::server
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+struct ssl_ctx_st;
+
+namespace quiz::server {
+
+// TLS on the listener with the record layer in the kernel (kTLS). OpenSSL
+// runs the handshake on the still-blocking socket and installs the session
+// keys with TCP_ULP "tls"; it is then dropped. From there on the socket is
+// read and written as plaintext like any other and the kernel encrypts and
+// decrypts records, so the reactor and send paths carry no TLS code and no
+// per-byte crypto runs on our threads.
+//
+// Only connections offloaded in both directions are kept. A record that is
+// not application data (an alert, close_notify) makes recv fail, which
+// closes the connection.
+class KernelTls {
+ public:
+  // Loads a PEM certificate chain and private key. Fails when this kernel
+  // or OpenSSL build cannot offload TLS, since no connection could be kept.
+  static std::unique_ptr<KernelTls> create(const std::string& cert_file,
+                                           const std::string& key_file,
+                                           std::string* error = nullptr);
+  ~KernelTls();
+
+  KernelTls(const KernelTls&) = delete;
+  KernelTls& operator=(const KernelTls&) = delete;
+
+  // Runs the server side of the handshake on `fd`, giving the peer
+  // `timeout` per read or write. True once both directions are offloaded;
+  // otherwise the connection is unusable and must be closed.
+  bool handshake(int fd, std::chrono::milliseconds timeout, std::string* error = nullptr) const;
+
+ private:
+  explicit KernelTls(ssl_ctx_st* ctx) : ctx_(ctx) {}
+
+  ssl_ctx_st* ctx_;
+};
+
+}  // namespace quiz::server
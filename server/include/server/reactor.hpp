@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace quiz::server {
+
+class Connection;
+
+// Load figures for one shard over the last sampling window.
+struct ShardLoad {
+  std::size_t shard{};
+  std::size_t connections{};
+  std::uint64_t busy_ns{};  // time spent reading and framing
+  std::uint64_t frames{};
+};
+
+// One epoll loop owning a subset of the server's connections. All access to
+// the connection map happens on the shard thread; other threads talk to the
+// shard through its mailbox. A shard given a core pins its thread there and
+// allocates its per-connection state from that core's NUMA node.
+class ReactorShard {
+ public:
+  explicit ReactorShard(std::size_t index, int cpu = -1);
+  ~ReactorShard();
+
+  ReactorShard(const ReactorShard&) = delete;
+  ReactorShard& operator=(const ReactorShard&) = delete;
+
+  bool start();
+  void stop();
+
+  // Hand a connection to this shard (thread-safe).
+  void adopt(std::shared_ptr<Connection> conn);
+
+  // Start polling for writability because output is buffered (thread-safe).
+  void watch_writable(std::shared_ptr<Connection> conn);
+
+  // Stop polling a drained connection, then close it (thread-safe).
+  void retire(std::shared_ptr<Connection> conn);
+
+  // Move up to `max_moves` idle connections to `target`, busiest first, until
+  // roughly `busy_budget_ns` of recent load has been moved (thread-safe).
+  void migrate_to(ReactorShard& target, std::size_t max_moves, std::uint64_t busy_budget_ns);
+
+  // Start a new per-connection load window (thread-safe).
+  void roll_window();
+
+  // Returns load since the previous call and resets the counters.
+  ShardLoad sample_load();
+
+  std::size_t index() const { return index_; }
+  int cpu() const { return cpu_; }    // -1 when unpinned
+  int node() const { return node_; }  // -1 when unknown
+  std::size_t connection_count() const { return conn_count_.load(); }
+
+ private:
+  void loop();
+  void post(std::function<void()> fn);
+  void drain_mailbox();
+  void attach(const std::shared_ptr<Connection>& conn);
+  void detach(int fd);
+  bool owns(const std::shared_ptr<Connection>& conn) const;
+  void update_events(Connection& conn);
+
+  std::size_t index_;
+  int cpu_;
+  int node_{-1};
+  int epoll_fd_{-1};
+  int wake_fd_{-1};
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+
+  std::mutex mailbox_mtx_;
+  std::vector<std::function<void()>> mailbox_;
+
+  // Owned by the shard thread.
+  std::unordered_map<int, std::shared_ptr<Connection>> conns_;
+
+  std::atomic<std::size_t> conn_count_{0};
+  std::atomic<std::uint64_t> busy_ns_{0};
+  std::atomic<std::uint64_t> frames_{0};
+};
+
+}  // namespace quiz::server
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+
+namespace quiz::server {
+
+class Connection;
+
+// Per-request timing information, visible to handlers running on a worker.
+struct RequestContext {
+  std::chrono::steady_clock::time_point received_at{};
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  // Arena for the request's temporary containers; see request_memory().
+  std::pmr::memory_resource* memory{nullptr};
+  // The connection is encrypted by kernel TLS, so frames may skip our own AES.
+  bool kernel_tls{false};
+  // The connection the request arrived on; HELLO installs its GCM keys there.
+  Connection* connection{nullptr};
+
+  bool expired() const;
+  // Milliseconds left before the client gives up; nullopt without a deadline.
+  std::optional<std::int64_t> remaining_ms() const;
+  // True when there is no deadline or at least `needed` time is left.
+  bool has_budget(std::chrono::milliseconds needed) const;
+};
+
+// Context of the request being handled on this thread, or nullptr.
+const RequestContext* current_request();
+
+// Memory for containers that die with the current request: its arena while a
+// request is being handled, the default resource otherwise. Nothing allocated
+// here may outlive the request.
+std::pmr::memory_resource* request_memory();
+
+// Installs a context for the current thread for the lifetime of the scope.
+class ScopedRequestContext {
+ public:
+  explicit ScopedRequestContext(const RequestContext& ctx);
+  ~ScopedRequestContext();
+
+  ScopedRequestContext(const ScopedRequestContext&) = delete;
+  ScopedRequestContext& operator=(const ScopedRequestContext&) = delete;
+
+ private:
+  const RequestContext* previous_;
+};
+
+// Monotonic arena for one request, carved from a buffer the worker thread
+// reuses; everything is released at once when the scope ends. Scopes on one
+// thread must not nest.
+class ScopedRequestArena {
+ public:
+  ScopedRequestArena();
+
+  ScopedRequestArena(const ScopedRequestArena&) = delete;
+  ScopedRequestArena& operator=(const ScopedRequestArena&) = delete;
+
+  std::pmr::memory_resource* resource() { return &resource_; }
+
+ private:
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+}  // namespace quiz::server
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <functional>
+#include <future>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <optional>
-#include <random>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <sqlite3.h>
 
 #include "common/message.hpp"
+#include "server/stage.hpp"
 
 namespace quiz::server {
 
@@ -47,17 +52,56 @@ struct RoomDetails {
   std::vector<RoomParticipant> participants;
 };
 
+// A question as players see it; the correct option never leaves the server.
+// Allocator-aware, so a QuestionList keeps the strings in its arena too.
+struct Question {
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  Question() = default;
+  explicit Question(const allocator_type& alloc)
+      : text(alloc), options(alloc), topic(alloc), difficulty(alloc) {}
+  Question(const Question& other, const allocator_type& alloc)
+      : id(other.id),
+        text(other.text, alloc),
+        options(other.options, alloc),
+        topic(other.topic, alloc),
+        difficulty(other.difficulty, alloc) {}
+  Question(Question&& other, const allocator_type& alloc)
+      : id(other.id),
+        text(std::move(other.text), alloc),
+        options(std::move(other.options), alloc),
+        topic(std::move(other.topic), alloc),
+        difficulty(std::move(other.difficulty), alloc) {}
+  Question(const Question&) = default;
+  Question(Question&&) = default;
+  Question& operator=(const Question&) = default;
+  Question& operator=(Question&&) = default;
+
+  int id{};
+  std::pmr::string text;
+  std::pmr::string options;  // JSON object of label -> text, as stored
+  std::pmr::string topic;
+  std::pmr::string difficulty;
+};
+
+// {question_id, question_text, options, topic, difficulty}
+void to_json(nlohmann::json& j, const Question& q);
+
+// Questions picked for one request, allocated from its arena
+// (request_memory()); convert to JSON before the request ends.
+using QuestionList = std::pmr::vector<Question>;
+
 struct ExamPaper {
   int exam_id{};
   int room_id{};
-  std::vector<nlohmann::json> questions;
+  QuestionList questions;
   std::uint64_t start_time{};
   std::uint64_t end_time{};
 };
 
 struct PracticePaper {
   int practice_id{};
-  std::vector<nlohmann::json> questions;
+  QuestionList questions;
   std::uint64_t start_time{};
   std::uint64_t end_time{};
 };
@@ -74,21 +118,47 @@ struct RoomResultRow {
 
 struct RoomResult {
   std::vector<RoomResultRow> rows;
+  bool has_statistics{true};  // false when skipped to meet a request deadline
   double average_score{};
   double highest_score{};
   double lowest_score{};
   double pass_rate{};
 };
 
+struct HistoryExam {
+  int exam_id{};
+  int room_id{};
+  std::optional<std::string> room_name;  // unset once the room is deleted
+  double score{};
+  int correct{};
+  int total{};
+  std::uint64_t submitted_at{};
+};
+
+struct HistoryPractice {
+  int practice_id{};
+  double score{};
+  int correct{};
+  int total{};
+  std::uint64_t submitted_at{};
+  std::string settings_json;  // as stored; empty when missing
+};
+
 struct UserHistory {
-  nlohmann::json exams;       // array
-  nlohmann::json practices;  // array
+  std::vector<HistoryExam> exams;
+  std::vector<HistoryPractice> practices;
   double avg_score{};
 };
 
+// Room state is owned by actors: every operation on a room runs on the
+// serialized executor that room hashes to, with that executor's own SQLite
+// connection, so independent rooms proceed in parallel. Practice runs are
+// keyed by user the same way. An actor opens its connection once, when it is
+// created, and takes no lock beyond its own queue. Cross-room reads (room
+// lists, history) and room creation borrow an idle connection of their own.
 class RoomManager {
  public:
-  explicit RoomManager(std::string db_path);
+  explicit RoomManager(std::string db_path, std::size_t actors = 4);
   ~RoomManager();
 
   RoomManager(const RoomManager&) = delete;
@@ -131,10 +201,27 @@ class RoomManager {
                        double& score,
                        std::string* error = nullptr);
 
-  std::optional<RoomResult> get_room_results(int room_id, std::string* error = nullptr);
+  // Statistics are only computed when `with_statistics` is true.
+  std::optional<RoomResult> get_room_results(int room_id, std::string* error = nullptr,
+                                             bool with_statistics = true);
+
+  // Results of rooms of any size without holding them: rows are read on a
+  // connection of the call's own, so a slow consumer stalls no actor, and
+  // handed to `on_batch` up to `batch_rows` at a time. The returned result
+  // carries the statistics but no rows. Returning false from on_batch stops
+  // the walk and the call returns nullopt.
+  std::optional<RoomResult> export_room_results(
+      int room_id, std::size_t batch_rows,
+      const std::function<bool(const std::vector<RoomResultRow>&)>& on_batch,
+      std::string* error = nullptr);
 
   std::optional<UserHistory> get_user_history(int user_id, std::string* error = nullptr);
 
+  // Adds a batch of questions in one transaction; all or none. Each needs
+  // question_text, options (label -> text), correct_option (one of the
+  // labels), difficulty (EASY, MEDIUM or HARD) and topic. Returns the count.
+  std::optional<int> add_questions(const nlohmann::json& questions, std::string* error = nullptr);
+
   std::optional<RoomDetails> get_room_details(int room_id, std::string* error = nullptr);
 
   // Delete a room (only creator can delete, not allowed for IN_PROGRESS rooms)
@@ -157,25 +244,44 @@ class RoomManager {
 
   bool exam_owned_by(int exam_id, int user_id);
 
+  // Queue and service figures of each room actor.
+  nlohmann::json stats();
+
  private:
-  bool open_db();
-  std::vector<nlohmann::json> pick_questions(const RoomSettings& settings, std::string* error);
-  std::vector<nlohmann::json> pick_questions_filtered(int count,
-                                                      const std::vector<std::string>& difficulties,
-                                                      const std::vector<std::string>& topics,
-                                                      std::string* error);
+  struct Actor;
+  class ScopedConnection;
+
+  sqlite3* db() const;  // the connection of the current actor or ScopedConnection
+  Actor& actor_for(int key);
+  template <typename Fn>
+  auto post_to_actor(int key, Fn fn) -> std::future<decltype(fn())>;
+  // Runs `fn` on the actor for `key` and waits for its result.
+  template <typename Fn>
+  auto on_actor(int key, Fn&& fn) -> decltype(fn());
+  int room_of_exam(int exam_id);
+  bool auto_submit_exam(int exam_id, std::uint64_t now);
+  QuestionList pick_questions(const RoomSettings& settings, std::string* error);
+  QuestionList pick_questions_filtered(int count,
+                                       const std::vector<std::string>& difficulties,
+                                       const std::vector<std::string>& topics,
+                                       std::string* error);
   int ensure_exam(int room_id, int user_id, std::uint64_t start_time, std::uint64_t end_time, std::string* error);
   bool is_room_waiting(int room_id);
   bool is_participant(int room_id, int user_id);
 
   // Helper functions for exam questions management
-  std::vector<nlohmann::json> load_exam_questions(int exam_id, std::string* error);
-  bool save_exam_questions(int exam_id, const std::vector<nlohmann::json>& questions, std::string* error);
+  QuestionList load_exam_questions(int exam_id, std::string* error);
+  bool save_exam_questions(int exam_id, const QuestionList& questions, std::string* error);
 
   std::string db_path_;
-  sqlite3* db_{nullptr};
-  std::mt19937 rng_;
-  mutable std::recursive_mutex db_mutex_;  // Protect database access from multiple threads
+  std::vector<std::unique_ptr<Actor>> actors_;
+  // Idle connections for work outside the actors; the mutex only guards the
+  // list, never a query, and actors never take it.
+  std::mutex idle_dbs_mutex_;
+  std::vector<sqlite3*> idle_dbs_;
+
+  std::mutex exam_rooms_mutex_;
+  std::unordered_map<int, int> exam_rooms_;  // exam id -> room id
 };
 
 }  // namespace quiz::server
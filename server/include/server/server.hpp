@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
@@ -10,31 +14,116 @@
 #include <thread>
 #include <vector>
 
+#include "common/aes_crypto.hpp"
+#include "common/codec.hpp"
 #include "common/message.hpp"
+#include "server/ktls.hpp"
+#include "server/reactor.hpp"
+#include "server/request_context.hpp"
+#include "server/stage.hpp"
 #include "server/thread_pool.hpp"
 
 namespace quiz::server {
 
+class ChunkWriter;
 class Connection;
+class DeferredReply;
+class StreamConsumer;
+struct InboundStream;
 
 using HandlerFn = std::function<quiz::Message(const quiz::Message&)>;
+// Streamed responses (v2 only): the handler sends pieces through the writer
+// as it produces them; the Message it returns ends the stream.
+using StreamHandlerFn = std::function<quiz::Message(const quiz::Message&, ChunkWriter&)>;
+// Handlers whose work runs on another executor: the handler hands the reply
+// on and returns, freeing the worker; whoever holds it answers later.
+using DeferredHandlerFn = std::function<void(const quiz::Message&, DeferredReply)>;
+// Chunked uploads: one consumer is made per stream, on its first chunk.
+using StreamConsumerFactory = std::function<std::unique_ptr<StreamConsumer>()>;
+
+// Whether a handler reads the request's `data`. Request bodies arrive
+// unparsed and are only parsed right before a Parsed handler runs, so
+// rejected requests and EnvelopeOnly handlers never pay for them.
+enum class HandlerData { Parsed, EnvelopeOnly };
+
+// Thread budget and queue bound of each request pipeline stage. Reactors only
+// cut frames; decode decrypts and parses, dispatch runs handlers, encode
+// encrypts and writes the response.
+struct PipelineConfig {
+  std::size_t reactors{2};
+  std::size_t decode_threads{1};
+  std::size_t decode_queue{1024};
+  std::size_t dispatch_threads{4};      // initial and minimum
+  std::size_t dispatch_max_threads{0};  // grows up to this; 0 = fixed size
+  std::size_t dispatch_queue{4096};
+  std::size_t encode_threads{1};
+  std::size_t encode_queue{1024};
+  // Optional core pinning. Reactor shard i runs on reactor_cpus[i % n];
+  // dispatch workers are spread round-robin over dispatch_cpus. Empty lists
+  // leave placement to the kernel.
+  std::vector<int> reactor_cpus;
+  std::vector<int> dispatch_cpus;
+};
 
 class Server {
  public:
-  Server(std::string host, uint16_t port, std::size_t workers = 4);
+  Server(std::string host, uint16_t port, std::size_t workers = 4, std::size_t reactors = 2);
+  Server(std::string host, uint16_t port, const PipelineConfig& config);
   ~Server();
 
-  void register_handler(const std::string& action, HandlerFn handler);
+  void register_handler(const Action& action, HandlerFn handler,
+                        HandlerData data = HandlerData::Parsed);
+  void register_stream_handler(const Action& action, StreamHandlerFn handler);
+  void register_deferred_handler(const Action& action, DeferredHandlerFn handler,
+                                 HandlerData data = HandlerData::Parsed);
+  void register_stream_consumer(const Action& action, StreamConsumerFactory factory);
+
+  // Serve TLS instead of plain TCP, with records handled by the kernel (see
+  // KernelTls). Call before start(); false (error filled) if the certificate
+  // or key cannot be loaded or the kernel cannot offload TLS.
+  bool enable_tls(const std::string& cert_file, const std::string& key_file,
+                  std::string* error = nullptr);
 
   bool start();
   void stop();
   void run();  // blocking loop until stop is requested (Ctrl+C).
 
+  // Pipeline entry points; each request holds one in-flight slot on its
+  // connection from submit_frame until its response is written. Responses
+  // reuse the request's frame header (version, request_id, ...). Frames,
+  // requests and responses are moved from stage to stage, never copied.
+  void submit_frame(const std::shared_ptr<Connection>& conn, std::vector<std::uint8_t> frame);
+  // `received_at` is when the frame was read; deadlines count from there,
+  // so time queued for decode is charged to the request.
   void handle_message(const std::shared_ptr<Connection>& conn,
-                      const quiz::Message& msg);
+                      quiz::Message msg,
+                      const quiz::FrameHeader& header = {},
+                      std::chrono::steady_clock::time_point received_at =
+                          std::chrono::steady_clock::now());
+  void respond(const std::shared_ptr<Connection>& conn, quiz::Message resp,
+               const quiz::FrameHeader& header = {});
+  void remove_connection(const std::shared_ptr<Connection>& conn);
+
+  // Snapshot of connection, shard and pipeline stage figures for monitoring.
+  nlohmann::json stats();
 
  private:
+  // Chunks of an upload run one at a time and in sequence order, whichever
+  // worker picks them up.
+  void consume_chunk(const std::shared_ptr<Connection>& conn, quiz::Message msg,
+                     const quiz::FrameHeader& header);
+  void run_chunk(const std::shared_ptr<Connection>& conn, InboundStream& stream,
+                 quiz::Message msg, const quiz::FrameHeader& header);
+  // Like respond, with the reply header already built.
+  void send_reply(const std::shared_ptr<Connection>& conn, quiz::Message resp,
+                  const quiz::FrameHeader& reply);
+
   void accept_loop();
+  // Registers an accepted (and, under TLS, handshaken) socket with a shard.
+  void admit(int fd, bool kernel_tls);
+  void balance_loop();
+  void rebalance_once();
+  ReactorShard& pick_shard();
   void close_all_connections();
 
   std::string host_;
@@ -43,33 +132,221 @@ class Server {
   int listen_fd_{-1};
   std::thread accept_thread_;
 
+  // Reactor shards and the periodic load balancer that migrates idle
+  // connections away from hot shards.
+  std::vector<std::unique_ptr<ReactorShard>> shards_;
+  std::thread balance_thread_;
+  std::mutex balance_mtx_;
+  std::condition_variable balance_cv_;
+  std::chrono::milliseconds rebalance_interval_{2000};
+
   std::mutex conns_mtx_;
   std::vector<std::shared_ptr<Connection>> connections_;
 
-  ThreadPool workers_;
+  Stage decode_stage_;
+  ThreadPool workers_;  // dispatch stage
+  Stage encode_stage_;
+  std::atomic<std::uint64_t> expired_dropped_{0};
+  std::atomic<std::uint64_t> data_parsed_{0};
+  std::atomic<std::uint64_t> data_skipped_{0};
+  std::atomic<std::uint64_t> streams_sent_{0};
+  std::atomic<std::uint64_t> streams_received_{0};
+
+  // Set by enable_tls. Handshakes block on the peer, so they run on their
+  // own stage rather than on the accept thread.
+  std::unique_ptr<KernelTls> tls_;
+  std::unique_ptr<Stage> handshake_stage_;
+  std::atomic<std::uint64_t> tls_accepted_{0};
+  std::atomic<std::uint64_t> tls_failed_{0};
+
+  // One of fn, stream, deferred or consumer is set.
+  struct Handler {
+    HandlerFn fn;
+    HandlerData data{HandlerData::Parsed};
+    StreamHandlerFn stream;
+    DeferredHandlerFn deferred;
+    StreamConsumerFactory consumer;
+  };
+  // Shared so a lookup costs a reference count, not copies of the
+  // std::functions and their captures. Null when nothing is registered.
+  std::shared_ptr<const Handler> find_handler(const Action& action);
+  void set_handler(const Action& action, Handler handler);
+
   std::mutex handlers_mtx_;
-  std::map<std::string, HandlerFn> handlers_;
+  std::array<std::shared_ptr<const Handler>, kActionCount> handlers_;  // by ActionId
+  std::map<std::string, std::shared_ptr<const Handler>, std::less<>> extensions_;
+  std::array<std::atomic<std::uint64_t>, kActionCount> requests_by_action_{};
+
+  friend class DeferredReply;
+};
+
+// Receives a chunked upload. on_chunk sees every chunk, the last one
+// included, in sequence order; returning a response ends the stream early
+// (typically with an error). Otherwise finish answers the upload after the
+// last chunk.
+class StreamConsumer {
+ public:
+  virtual ~StreamConsumer() = default;
+  virtual std::optional<quiz::Message> on_chunk(const quiz::Message& chunk) = 0;
+  virtual quiz::Message finish() = 0;
+};
+
+// Upload progress on one connection, keyed by request_id.
+struct InboundStream {
+  struct Chunk {
+    quiz::Message msg;
+    quiz::FrameHeader header;
+  };
+  std::mutex mtx;
+  std::unique_ptr<StreamConsumer> consumer;
+  std::uint16_t next{0};
+  bool failed{false};  // answered early; later chunks are dropped
+  bool done{false};
+  std::map<std::uint16_t, Chunk> early;  // chunks that overtook an earlier one
+};
+
+// Sends the chunks of a streamed response. Each write is one frame; when
+// the client is behind on reading, write waits for the backlog to drain
+// instead of buffering without bound.
+class ChunkWriter {
+ public:
+  ChunkWriter(std::shared_ptr<Connection> conn, const quiz::Message& request,
+              const quiz::FrameHeader& request_header);
+
+  // False once the client is gone or stopped reading; stop producing then.
+  bool write(nlohmann::json data);
+  std::uint16_t chunks_sent() const { return next_; }
+  // Header of the response that ends the stream.
+  quiz::FrameHeader end_header() const;
+
+ private:
+  std::shared_ptr<Connection> conn_;
+  Action action_;
+  std::string session_id_;
+  quiz::FrameHeader header_;
+  std::uint16_t next_{0};
+  bool ok_{true};
+};
+
+// Answers a request after its deferred handler returned, from any thread.
+// Copies share one answer: the first call sends it and later ones are
+// ignored. A request still unanswered when the last copy goes gets a
+// HANDLER_ERROR, so a lost reply cannot leave the client waiting.
+class DeferredReply {
+ public:
+  DeferredReply(Server* server, std::shared_ptr<Connection> conn, const quiz::Message& request,
+                const quiz::FrameHeader& request_header, const RequestContext& ctx);
+
+  void operator()(quiz::Message resp) const;
+  // Ends the request unanswered, as for any request past its deadline.
+  void drop() const;
+  // Timing of the request; it carries no arena any more.
+  const RequestContext& context() const;
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
 };
 
 class Connection : public std::enable_shared_from_this<Connection> {
  public:
-  Connection(int fd, Server* server, std::string peer);
+  // `kernel_tls`: the socket's records are already encrypted by the kernel.
+  Connection(int fd, Server* server, std::string peer, bool kernel_tls = false);
   ~Connection();
 
-  void start();
   void stop();
-  void send(const quiz::Message& msg);
+  // Encodes and writes without blocking; whatever the socket does not take
+  // is buffered and flushed by the owning shard. False if nothing was queued.
+  bool send(const quiz::Message& msg, const quiz::FrameHeader& header = {});
+  // Blocks until at most `limit` bytes of output are buffered. False when
+  // the connection closed or `timeout` passed first.
+  bool wait_drained(std::size_t limit, std::chrono::milliseconds timeout);
   std::string peer() const { return peer_; }
+  int fd() const { return fd_; }
+  bool kernel_tls() const { return kernel_tls_; }
+
+  // Reads what is available on the socket and submits every complete
+  // frame to the decode stage. Returns false once the peer closed or the
+  // stream is unusable.
+  bool on_readable(std::uint64_t& frames);
+
+  // Once a peer has sent a GCM frame, every later one must be GCM too, so
+  // the connection cannot be downgraded to unauthenticated CBC; plaintext
+  // frames need kernel TLS. A GCM frame needs the keys from HELLO and gets
+  // the next inbound sequence number in `gcm`, which frames are numbered
+  // by in the order they arrive. Called on the owning shard; false (error
+  // filled) for a frame to drop.
+  bool accept_cipher(const quiz::FrameHeader& header, quiz::GcmFrameKey& gcm,
+                     std::string& error);
+  // Keys agreed in HELLO. Set once; false if the connection already has them.
+  bool set_gcm_keys(const quiz::GcmKeys& keys);
+  // Ends a connection whose stream can no longer be trusted (a GCM frame
+  // failed to open); the shard sees EOF and closes.
+  void abort();
+
+  // Writes buffered output; called by the shard when the socket is writable.
+  void flush();
+  bool write_pending() const { return write_pending_.load(); }
+
+  // True when no partial frame is buffered, no request is in flight and no
+  // output is pending, so the connection can safely move to another shard.
+  bool idle() const {
+    return inbuf_.empty() && inflight_.load() == 0 && !write_pending_.load();
+  }
+
+  void begin_request() { inflight_.fetch_add(1); }
+  void end_request();
+
+  // Called when the peer stopped sending: closes once the last in-flight
+  // response has been written out.
+  void close_when_done();
+
+  // Upload with this request_id, created if there is room for another;
+  // nullptr when too many are already in progress.
+  std::shared_ptr<InboundStream> inbound_stream(std::uint32_t id);
+  void end_inbound_stream(std::uint32_t id);
 
  private:
-  void read_loop();
+  friend class ReactorShard;
+
+  bool close_fd();  // false if already closed
+  void write_buffered();  // requires send_mtx_
 
   int fd_;
   Server* server_;
   std::string peer_;
+  const bool kernel_tls_;
   std::atomic<bool> alive_{true};
-  std::thread reader_;
+  std::atomic<ReactorShard*> shard_{nullptr};
+
+  // Output not yet accepted by the socket, guarded by send_mtx_.
   std::mutex send_mtx_;
+  std::vector<std::uint8_t> outbuf_;
+  std::atomic<bool> write_pending_{false};
+  std::condition_variable drained_cv_;  // outbuf_ shrank or the socket closed
+
+  // GCM keys, written once by HELLO before gcm_ready_ is set.
+  quiz::GcmKeys gcm_keys_;
+  std::atomic<bool> gcm_claimed_{false};
+  std::atomic<bool> gcm_ready_{false};
+  // GCM replies must reach the socket in the order they are numbered, so
+  // they are sealed and queued one at a time under seal_mtx_.
+  std::mutex seal_mtx_;
+  std::uint64_t send_sequence_{0};  // last number sent, guarded by seal_mtx_
+
+  std::mutex streams_mtx_;
+  std::map<std::uint32_t, std::shared_ptr<InboundStream>> inbound_;
+
+  // Parse state, owned by whichever shard currently holds the connection.
+  std::vector<std::uint8_t> inbuf_;
+  bool reading_{true};
+  std::uint32_t events_{0};
+  bool authenticated_{false};
+  std::uint64_t recv_sequence_{0};  // last GCM frame number handed out
+  std::atomic<int> inflight_{0};
+  std::atomic<bool> closing_{false};
+  std::uint64_t busy_ns_{0};
+  std::uint64_t busy_mark_{0};
 };
 
 }  // namespace quiz::server
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+namespace quiz::server {
+
+// Builds the coalescing key for a read: the action plus only the parameters
+// that determine its result. nlohmann objects keep keys sorted, so the dump
+// is canonical.
+inline std::string single_flight_key(std::string_view action, const nlohmann::json& params) {
+  std::string key(action);
+  key += ':';
+  key += params.dump();
+  return key;
+}
+
+// Collapses concurrent identical calls: the first caller for a key runs the
+// computation, callers arriving while it is in flight wait for and share its
+// result. Nothing is cached once the call completes.
+template <typename Result>
+class SingleFlight {
+ public:
+  Result run(const std::string& key, const std::function<Result()>& fn) {
+    std::promise<Result> promise;
+    std::shared_future<Result> future;
+    bool leader = false;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      auto it = calls_.find(key);
+      if (it != calls_.end()) {
+        future = it->second;
+      } else {
+        future = promise.get_future().share();
+        calls_.emplace(key, future);
+        leader = true;
+      }
+    }
+    if (!leader) {
+      shared_.fetch_add(1);
+      return future.get();
+    }
+
+    executed_.fetch_add(1);
+    try {
+      promise.set_value(fn());
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      calls_.erase(key);
+    }
+    return future.get();
+  }
+
+  nlohmann::json stats() const {
+    return {{"executed", executed_.load()}, {"shared", shared_.load()}};
+  }
+
+ private:
+  std::mutex mtx_;
+  std::unordered_map<std::string, std::shared_future<Result>> calls_;
+  std::atomic<std::uint64_t> executed_{0};
+  std::atomic<std::uint64_t> shared_{0};
+};
+
+}  // namespace quiz::server
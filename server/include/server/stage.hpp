@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace quiz::server {
+
+// Queue-time and service-time counters for one pipeline stage.
+class StageMetrics {
+ public:
+  void record(std::uint64_t queue_ns, std::uint64_t service_ns);
+  void reject() { rejected_.fetch_add(1); }
+
+  // Totals, averages and maxima since start, in microseconds.
+  nlohmann::json snapshot() const;
+
+ private:
+  std::atomic<std::uint64_t> processed_{0};
+  std::atomic<std::uint64_t> rejected_{0};
+  std::atomic<std::uint64_t> queue_ns_{0};
+  std::atomic<std::uint64_t> service_ns_{0};
+  std::atomic<std::uint64_t> max_queue_ns_{0};
+  std::atomic<std::uint64_t> max_service_ns_{0};
+};
+
+// A pipeline stage: a bounded FIFO served by a fixed number of threads.
+class Stage {
+ public:
+  Stage(std::string name, std::size_t threads, std::size_t capacity);
+  ~Stage();
+
+  Stage(const Stage&) = delete;
+  Stage& operator=(const Stage&) = delete;
+
+  // Waits while the queue is full. Returns false once the stage is stopping.
+  bool push(std::function<void()> task);
+  // Returns false instead of waiting when the queue is full.
+  bool try_push(std::function<void()> task);
+
+  // Runs what is already queued, then joins the threads.
+  void shutdown();
+
+  nlohmann::json stats();
+
+ private:
+  struct Item {
+    std::function<void()> task;
+    std::chrono::steady_clock::time_point enqueued_at;
+  };
+
+  void worker_loop();
+
+  std::string name_;
+  std::size_t capacity_;
+  std::mutex mtx_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<Item> queue_;
+  bool stopping_{false};
+  std::vector<std::thread> threads_;
+  StageMetrics metrics_;
+};
+
+}  // namespace quiz::server
@@ -1,30 +1,127 @@
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <map>
 #include <mutex>
-#include <queue>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "server/stage.hpp"
+
 namespace quiz::server {
 
+struct ThreadPoolOptions {
+  std::size_t min_workers{4};
+  std::size_t max_workers{4};  // equal to min_workers disables resizing
+  std::size_t capacity{0};     // bound on queued tasks, 0 = unbounded
+  std::chrono::microseconds quantum{2000};
+  // Resizing: evaluated every `resize_interval`; the pool grows while tasks
+  // wait longer than `target_queue_wait` and the workers are saturated.
+  std::chrono::milliseconds resize_interval{500};
+  std::chrono::microseconds target_queue_wait{5000};
+  // Cores to pin workers to, assigned round-robin as workers start; empty
+  // leaves placement to the kernel.
+  std::vector<int> cpus;
+};
+
+// Worker pool with one sub-queue per client. Clients are served with deficit
+// round-robin over the CPU time their tasks use, so a client flooding the
+// pool only delays its own requests. `capacity` bounds the total queued tasks (0 means
+// unbounded).
+//
+// With max_workers > min_workers the pool resizes itself from queue wait,
+// busy time and the share of busy time workers spend blocked (wall minus CPU
+// time, i.e. SQLite, locks, I/O). Blocked workers justify threads beyond the
+// core count; CPU-bound ones do not.
 class ThreadPool {
  public:
-  explicit ThreadPool(std::size_t workers);
+  explicit ThreadPool(std::size_t workers, std::size_t capacity = 0,
+                      std::chrono::microseconds quantum = std::chrono::microseconds(2000));
+  explicit ThreadPool(const ThreadPoolOptions& options);
   ~ThreadPool();
 
-  void enqueue(std::function<void()> task);
+  // Tasks without a client key share the "" sub-queue. Returns false when
+  // the pool is full or stopping; the task is then dropped.
+  bool enqueue(std::function<void()> task);
+  bool enqueue(const std::string& client, std::function<void()> task);
+  // Urgent tasks run ahead of the client's other queued tasks; fairness
+  // between clients is unchanged.
+  bool enqueue(const std::string& client, bool urgent, std::function<void()> task);
   void shutdown();
 
+  // Number of queued (not yet running) tasks per client.
+  std::map<std::string, std::size_t> queue_depths();
+  std::size_t pending();
+
+  // Stage-style figures: thread count, bound, queue and service times.
+  nlohmann::json stats();
+
  private:
-  void worker_loop();
+  struct Item {
+    std::function<void()> task;
+    std::chrono::steady_clock::time_point enqueued_at;
+    bool urgent{false};
+  };
+
+  // A client's queue and account. Flows outlive their queue by a grace
+  // period, so a client with one request in flight at a time is still
+  // charged what its requests cost.
+  struct Flow {
+    std::deque<Item> tasks;
+    std::int64_t deficit_ns{0};
+    std::int64_t est_cost_ns{0};  // moving average of service CPU time
+    std::size_t running{0};
+    std::chrono::steady_clock::time_point idle_since;
+  };
+
+  void worker_loop(int cpu);
+  // Picks the next task under DRR; returns false when this worker should
+  // exit (stopping and drained, or retired by the sizer).
+  bool next_task(std::unique_lock<std::mutex>& lock, std::string& client,
+                 Item& item, std::int64_t& charged_ns);
+  // Forgets flows idle for the grace period; requires mtx_.
+  void prune_flows(std::chrono::steady_clock::time_point now);
+  void spawn_worker();  // requires mtx_
+  void sizer_loop();
+  void resize_once(std::unique_lock<std::mutex>& lock);
+  void join_exited(std::unique_lock<std::mutex>& lock);
 
   std::mutex mtx_;
   std::condition_variable cv_;
-  std::queue<std::function<void()>> tasks_;
+  std::condition_variable sizer_cv_;
+  std::unordered_map<std::string, Flow> flows_;
+  std::deque<std::string> active_;  // clients with queued tasks, in service order
+  std::chrono::steady_clock::time_point last_prune_{std::chrono::steady_clock::now()};
+  std::size_t pending_{0};
+  std::size_t capacity_;
+  std::int64_t quantum_ns_;
+  std::int64_t default_cost_ns_;
   bool stopping_{false};
-  std::vector<std::thread> threads_;
+  std::unordered_map<std::thread::id, std::thread> threads_;
+  std::vector<std::thread::id> exited_;
+  std::thread sizer_;
+  StageMetrics metrics_;
+  std::vector<int> cpus_;
+  std::size_t spawned_{0};  // drives round-robin pinning, guarded by mtx_
+
+  // Sizing state, guarded by mtx_.
+  std::size_t min_workers_;
+  std::size_t max_workers_;
+  std::size_t live_workers_{0};
+  std::size_t retire_{0};
+  std::chrono::nanoseconds resize_interval_;
+  std::int64_t target_wait_ns_;
+  std::int64_t window_wait_ns_{0};
+  std::int64_t window_busy_ns_{0};
+  std::int64_t window_blocked_ns_{0};
+  std::uint64_t window_tasks_{0};
+  int idle_windows_{0};
 };
 
 }  // namespace quiz::server
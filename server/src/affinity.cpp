@@ -0,0 +1,82 @@
+#include "server/affinity.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef QUIZ_HAVE_NUMA
+#include <numa.h>
+#endif
+
+namespace quiz::server {
+
+bool parse_cpu_list(const std::string& spec, std::vector<int>& out, std::string* error) {
+  out.clear();
+  std::size_t pos = 0;
+  while (pos < spec.size()) {
+    std::size_t comma = spec.find(',', pos);
+    if (comma == std::string::npos) comma = spec.size();
+    const std::string item = spec.substr(pos, comma - pos);
+    pos = comma + 1;
+    if (item.empty()) continue;
+
+    int first = 0;
+    int last = 0;
+    try {
+      std::size_t used = 0;
+      first = std::stoi(item, &used);
+      last = first;
+      if (used < item.size()) {
+        if (item[used] != '-') throw std::invalid_argument(item);
+        const std::string tail = item.substr(used + 1);
+        std::size_t tail_used = 0;
+        last = std::stoi(tail, &tail_used);
+        if (tail_used != tail.size()) throw std::invalid_argument(item);
+      }
+    } catch (const std::exception&) {
+      if (error) *error = "invalid cpu list entry '" + item + "'";
+      return false;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      if (error) *error = "invalid cpu range '" + item + "'";
+      return false;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) out.push_back(cpu);
+  }
+  return true;
+}
+
+bool pin_current_thread(int cpu, std::string* error) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    if (error) *error = "cpu " + std::to_string(cpu) + " out of range";
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int rc = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+  if (rc != 0) {
+    if (error) *error = "pin to cpu " + std::to_string(cpu) + ": " + std::strerror(rc);
+    return false;
+  }
+#ifdef QUIZ_HAVE_NUMA
+  int node = numa_node_of_cpu(cpu);
+  if (node >= 0) ::numa_set_preferred(node);
+#endif
+  return true;
+}
+
+int numa_node_of_cpu(int cpu) {
+#ifdef QUIZ_HAVE_NUMA
+  if (::numa_available() < 0) return -1;
+  return ::numa_node_of_cpu(cpu);
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+}  // namespace quiz::server
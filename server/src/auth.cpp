@@ -1,9 +1,15 @@
 #include "server/auth.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <random>
 #include <sstream>
+#include <string_view>
 
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <sqlite3.h>
 
 #include "common/crypto.hpp"
@@ -17,14 +23,199 @@ std::uint64_t now_seconds() {
   return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
 }
 
+constexpr char kSignedPrefix[] = "st1.";
+
+std::string to_hex(const void* data, std::size_t len) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  const auto* bytes = static_cast<const std::uint8_t*>(data);
+  std::string out;
+  out.reserve(len * 2);
+  for (std::size_t i = 0; i < len; ++i) {
+    out.push_back(kHex[bytes[i] >> 4]);
+    out.push_back(kHex[bytes[i] & 0xF]);
+  }
+  return out;
+}
+
+bool from_hex(std::string_view text, std::string& out) {
+  if (text.size() % 2 != 0) return false;
+  auto nibble = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+  };
+  out.clear();
+  for (std::size_t i = 0; i < text.size(); i += 2) {
+    const int hi = nibble(text[i]);
+    const int lo = nibble(text[i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out.push_back(static_cast<char>(hi << 4 | lo));
+  }
+  return true;
+}
+
+bool parse_u64(std::string_view text, std::uint64_t& out) {
+  if (text.empty() || text.size() > 19) return false;
+  out = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') return false;
+    out = out * 10 + static_cast<std::uint64_t>(c - '0');
+  }
+  return true;
+}
+
+// HMAC-SHA256 on a context kept per thread; the one-shot HMAC() looks up
+// the digest and allocates a context on every call.
+bool hmac_sha256(const std::uint8_t* key, std::size_t key_len, std::string_view data,
+                 std::uint8_t* out) {
+  struct MacContext {
+    EVP_MAC* mac{EVP_MAC_fetch(nullptr, OSSL_MAC_NAME_HMAC, nullptr)};
+    EVP_MAC_CTX* ctx{mac ? EVP_MAC_CTX_new(mac) : nullptr};
+    bool ok{false};
+    MacContext() {
+      char digest[] = "SHA256";
+      const OSSL_PARAM params[] = {
+          OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+          OSSL_PARAM_construct_end()};
+      ok = ctx && EVP_MAC_CTX_set_params(ctx, params) == 1;
+    }
+    ~MacContext() {
+      EVP_MAC_CTX_free(ctx);
+      EVP_MAC_free(mac);
+    }
+  };
+  thread_local MacContext m;
+  std::size_t len = 0;
+  return m.ok && EVP_MAC_init(m.ctx, key, key_len, nullptr) == 1 &&
+         EVP_MAC_update(m.ctx, reinterpret_cast<const std::uint8_t*>(data.data()), data.size()) ==
+             1 &&
+         EVP_MAC_final(m.ctx, out, &len, 32) == 1 && len == 32;
+}
+
 }  // namespace
 
-AuthService::AuthService(std::string db_path) : db_path_(std::move(db_path)) {
+SessionSigner::SessionSigner(std::chrono::seconds rotation) : rotation_(rotation) {}
+
+bool SessionSigner::is_signed(const std::string& token) {
+  return token.rfind(kSignedPrefix, 0) == 0;
+}
+
+std::string SessionSigner::mac(const Key& key, std::string_view signed_part) const {
+  std::uint8_t digest[32];
+  if (!hmac_sha256(key.secret, sizeof(key.secret), signed_part, digest)) return {};
+  return to_hex(digest, sizeof(digest));
+}
+
+std::string SessionSigner::issue(const SessionInfo& session) {
+  std::unique_lock<std::shared_mutex> lock(mtx_);
+  const auto now = std::chrono::steady_clock::now();
+  if (current_ == 0 || now - keys_[current_].created >= rotation_) {
+    Key key{};
+    if (RAND_bytes(key.secret, sizeof(key.secret)) != 1) return {};
+    key.created = now;
+    keys_[++current_] = key;
+    // Older keys go once nothing they signed can still be valid.
+    const std::uint64_t wall = now_seconds();
+    for (auto it = keys_.begin(); it != keys_.end();) {
+      it = it->first != current_ && it->second.last_expiry < wall ? keys_.erase(it) : ++it;
+    }
+  }
+  Key& key = keys_[current_];
+  key.last_expiry = std::max(key.last_expiry, session.expires_at);
+  std::ostringstream oss;
+  oss << kSignedPrefix << current_ << '.' << session.user_id << '.' << session.expires_at << '.'
+      << session.role << '.' << to_hex(session.username.data(), session.username.size());
+  const std::string signed_part = oss.str();
+  const std::string tag = mac(key, signed_part);
+  if (tag.empty()) return {};
+  issued_.fetch_add(1);
+  return signed_part + '.' + tag;
+}
+
+std::optional<SessionInfo> SessionSigner::verify(const std::string& token, std::string* error) {
+  // Seven fields; the last takes whatever follows the sixth dot.
+  std::string_view fields[7];
+  std::string_view rest(token);
+  std::size_t count = 0;
+  for (; count < 6; ++count) {
+    const std::size_t dot = rest.find('.');
+    if (dot == std::string_view::npos) break;
+    fields[count] = rest.substr(0, dot);
+    rest.remove_prefix(dot + 1);
+  }
+  fields[6] = rest;
+
+  std::uint64_t key_id = 0;
+  std::uint64_t user_id = 0;
+  std::uint64_t expires = 0;
+  std::string username;
+  if (count != 6 || rest.find('.') != std::string_view::npos || !parse_u64(fields[1], key_id) ||
+      key_id > UINT32_MAX || !parse_u64(fields[2], user_id) || user_id > INT32_MAX ||
+      !parse_u64(fields[3], expires) || fields[4].empty() || !from_hex(fields[5], username)) {
+    rejected_.fetch_add(1);
+    if (error) *error = "Malformed session token";
+    return std::nullopt;
+  }
+  const std::string_view tag = fields[6];
+  const std::string_view signed_part = std::string_view(token).substr(0, token.size() - tag.size() - 1);
+  {
+    std::shared_lock<std::shared_mutex> lock(mtx_);
+    auto key = keys_.find(static_cast<std::uint32_t>(key_id));
+    const std::string expected = key == keys_.end() ? std::string() : mac(key->second, signed_part);
+    if (expected.empty() || expected.size() != tag.size() ||
+        CRYPTO_memcmp(expected.data(), tag.data(), tag.size()) != 0) {
+      rejected_.fetch_add(1);
+      if (error) *error = "Session not found";
+      return std::nullopt;
+    }
+    if (revoked_.count(std::string(tag)) != 0) {
+      rejected_.fetch_add(1);
+      if (error) *error = "Session not found";
+      return std::nullopt;
+    }
+  }
+  if (now_seconds() > expires) {
+    rejected_.fetch_add(1);
+    if (error) *error = "Session expired";
+    return std::nullopt;
+  }
+  verified_.fetch_add(1);
+  return SessionInfo{static_cast<int>(user_id), username, std::string(fields[4]), token, expires};
+}
+
+void SessionSigner::revoke(const std::string& token) {
+  // Only tokens that verify are remembered, so forged ones cannot fill the set.
+  auto session = verify(token);
+  if (!session) return;
+  const std::string tag = token.substr(token.rfind('.') + 1);
+  const std::uint64_t now = now_seconds();
+  std::unique_lock<std::shared_mutex> lock(mtx_);
+  for (auto it = revoked_.begin(); it != revoked_.end();) {
+    it = it->second < now ? revoked_.erase(it) : std::next(it);
+  }
+  revoked_.emplace(tag, session->expires_at);
+}
+
+nlohmann::json SessionSigner::stats() {
+  std::shared_lock<std::shared_mutex> lock(mtx_);
+  return {{"issued", issued_.load()},
+          {"verified", verified_.load()},
+          {"rejected", rejected_.load()},
+          {"keys", keys_.size()},
+          {"revoked", revoked_.size()}};
+}
+
+AuthService::AuthService(std::string db_path, std::size_t hash_threads, std::size_t hash_queue)
+    : db_path_(std::move(db_path)), hash_stage_("password", hash_threads, hash_queue) {
   open_db();
 }
 
 AuthService::~AuthService() {
+  // Queued logins still run and need the database.
+  hash_stage_.shutdown();
+  std::lock_guard<std::mutex> lock(mtx_);
   if (db_) sqlite3_close(db_);
+  db_ = nullptr;
 }
 
 bool AuthService::open_db() {
@@ -34,6 +225,8 @@ bool AuthService::open_db() {
     db_ = nullptr;
     return false;
   }
+  // Room actors write through their own connections; wait for their locks.
+  sqlite3_busy_timeout(db_, 5000);
   return true;
 }
 
@@ -46,6 +239,20 @@ std::string AuthService::random_token() {
   return oss.str();
 }
 
+bool AuthService::submit(std::function<void()> job) {
+  return hash_stage_.try_push(std::move(job));
+}
+
+void AuthService::enable_signed_tokens(std::chrono::seconds key_rotation) {
+  signer_ = std::make_unique<SessionSigner>(key_rotation);
+}
+
+nlohmann::json AuthService::stats() {
+  nlohmann::json out = {{"password_hashing", hash_stage_.stats()}};
+  if (signer_) out["signed_tokens"] = signer_->stats();
+  return out;
+}
+
 std::optional<int> AuthService::register_user(const std::string& username,
                                               const std::string& password,
                                               const std::string& full_name,
@@ -56,6 +263,11 @@ std::optional<int> AuthService::register_user(const std::string& username,
     if (error) *error = "DB open failed";
     return std::nullopt;
   }
+  const std::string hashed = hash_password(password);
+  if (hashed.empty()) {
+    if (error) *error = "Password hashing failed";
+    return std::nullopt;
+  }
   std::lock_guard<std::mutex> lock(mtx_);
   const char* sql = "INSERT INTO users(username, pass_hash, role, full_name, email, created_at) "
                     "VALUES(?,?,?,?,?, ?);";
@@ -64,7 +276,6 @@ std::optional<int> AuthService::register_user(const std::string& username,
     if (error) *error = sqlite3_errmsg(db_);
     return std::nullopt;
   }
-  auto hashed = hash_password(password);
   sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
   sqlite3_bind_text(stmt, 2, hashed.c_str(), -1, SQLITE_TRANSIENT);
   sqlite3_bind_text(stmt, 3, role.c_str(), -1, SQLITE_TRANSIENT);
@@ -91,33 +302,66 @@ std::optional<SessionInfo> AuthService::login(const std::string& username,
     if (error) *error = "DB open failed";
     return std::nullopt;
   }
-  std::lock_guard<std::mutex> lock(mtx_);
-
-  const char* sql_user = "SELECT id, pass_hash, role, full_name, email FROM users WHERE username = ?;";
-  sqlite3_stmt* stmt = nullptr;
-  if (sqlite3_prepare_v2(db_, sql_user, -1, &stmt, nullptr) != SQLITE_OK) {
-    if (error) *error = sqlite3_errmsg(db_);
-    return std::nullopt;
-  }
-  sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
-  if (sqlite3_step(stmt) != SQLITE_ROW) {
-    if (error) *error = "User not found";
+  int uid = 0;
+  std::string stored_hash;
+  std::string role;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    const char* sql_user = "SELECT id, pass_hash, role, full_name, email FROM users WHERE username = ?;";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql_user, -1, &stmt, nullptr) != SQLITE_OK) {
+      if (error) *error = sqlite3_errmsg(db_);
+      return std::nullopt;
+    }
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+      if (error) *error = "User not found";
+      sqlite3_finalize(stmt);
+      return std::nullopt;
+    }
+    uid = sqlite3_column_int(stmt, 0);
+    stored_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+    role = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
     sqlite3_finalize(stmt);
-    return std::nullopt;
   }
-  int uid = sqlite3_column_int(stmt, 0);
-  std::string stored_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-  std::string role = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-  sqlite3_finalize(stmt);
 
-  if (!verify_password(password, stored_hash)) {
+  // Hashing happens outside mtx_, so session checks never wait on it. A
+  // legacy or outdated hash is replaced while the password is at hand.
+  bool needs_rehash = false;
+  if (!verify_password(password, stored_hash, &needs_rehash)) {
     if (error) *error = "Invalid credentials";
     return std::nullopt;
   }
 
-  std::string token = random_token();
+  const std::string upgraded = needs_rehash ? hash_password(password) : std::string();
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  sqlite3_stmt* stmt = nullptr;
+  if (!upgraded.empty()) {
+    // Unless the password changed meanwhile.
+    const char* sql_upgrade = "UPDATE users SET pass_hash = ? WHERE id = ? AND pass_hash = ?;";
+    if (sqlite3_prepare_v2(db_, sql_upgrade, -1, &stmt, nullptr) == SQLITE_OK) {
+      sqlite3_bind_text(stmt, 1, upgraded.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_int(stmt, 2, uid);
+      sqlite3_bind_text(stmt, 3, stored_hash.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+  }
+
   std::uint64_t now = now_seconds();
   std::uint64_t expires = now + ttl_seconds;
+  if (signer_) {
+    // The token is the whole session; nothing to store.
+    SessionInfo session{uid, username, role, {}, expires};
+    session.token = signer_->issue(session);
+    if (session.token.empty()) {
+      if (error) *error = "Session signing failed";
+      return std::nullopt;
+    }
+    return session;
+  }
+  std::string token = random_token();
 
   const char* sql_sess = "INSERT INTO sessions(user_id, token, expires_at, created_at) VALUES(?,?,?,?);";
   if (sqlite3_prepare_v2(db_, sql_sess, -1, &stmt, nullptr) != SQLITE_OK) {
@@ -141,6 +385,10 @@ std::optional<SessionInfo> AuthService::login(const std::string& username,
 }
 
 bool AuthService::logout(const std::string& token, std::string* error) {
+  if (signer_ && SessionSigner::is_signed(token)) {
+    signer_->revoke(token);
+    return true;
+  }
   if (!open_db()) {
     if (error) *error = "DB open failed";
     return false;
@@ -159,6 +407,7 @@ bool AuthService::logout(const std::string& token, std::string* error) {
 }
 
 std::optional<SessionInfo> AuthService::validate(const std::string& token, std::string* error) {
+  if (signer_ && SessionSigner::is_signed(token)) return signer_->verify(token, error);
   if (!open_db()) {
     if (error) *error = "DB open failed";
     return std::nullopt;
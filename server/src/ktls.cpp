@@ -0,0 +1,121 @@
+#include "server/ktls.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace quiz::server {
+namespace {
+
+// Most recent OpenSSL error on this thread, for log lines.
+std::string openssl_error() {
+  const unsigned long code = ERR_get_error();
+  ERR_clear_error();
+  if (code == 0) return "connection closed or timed out";
+  char buf[256];
+  ERR_error_string_n(code, buf, sizeof(buf));
+  return buf;
+}
+
+// The tls module refuses sockets that are not connected yet, so an
+// unconnected one tells it apart from a kernel that does not have it.
+bool kernel_has_tls() {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  const int rc = ::setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+  const int err = errno;
+  ::close(fd);
+  return rc == 0 || err != ENOENT;
+}
+
+void set_timeouts(int fd, std::chrono::milliseconds timeout) {
+  timeval tv{};
+  tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+  tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+}  // namespace
+
+std::unique_ptr<KernelTls> KernelTls::create(const std::string& cert_file,
+                                             const std::string& key_file, std::string* error) {
+#ifdef OPENSSL_NO_KTLS
+  if (error) *error = "OpenSSL was built without kernel TLS";
+  return nullptr;
+#endif
+  if (!kernel_has_tls()) {
+    if (error) *error = "kernel TLS unavailable (is the tls module loaded?)";
+    return nullptr;
+  }
+  SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    if (error) *error = "SSL_CTX_new failed: " + openssl_error();
+    return nullptr;
+  }
+  std::unique_ptr<KernelTls> tls(new KernelTls(ctx));
+
+  // Only what the kernel can take over: AES-GCM, no renegotiation and no
+  // session tickets to send after the handshake. OpenSSL offloads receiving
+  // TLS 1.3 records only from 3.2 on, so older builds stay on TLS 1.2.
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_TICKET);
+  SSL_CTX_set_num_tickets(ctx, 0);
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  if (OpenSSL_version_num() < 0x30200000L) {
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+  }
+  if (SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM") != 1 ||
+      SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384") != 1) {
+    if (error) *error = "no usable cipher: " + openssl_error();
+    return nullptr;
+  }
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1) {
+    if (error) *error = "cannot load certificate " + cert_file + ": " + openssl_error();
+    return nullptr;
+  }
+  if (SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    if (error) *error = "cannot load private key " + key_file + ": " + openssl_error();
+    return nullptr;
+  }
+  return tls;
+}
+
+KernelTls::~KernelTls() {
+  SSL_CTX_free(ctx_);
+}
+
+bool KernelTls::handshake(int fd, std::chrono::milliseconds timeout, std::string* error) const {
+  ERR_clear_error();
+  set_timeouts(fd, timeout);
+  SSL* ssl = SSL_new(ctx_);
+  bool ok = false;
+  if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+    if (error) *error = "SSL setup failed: " + openssl_error();
+  } else if (SSL_accept(ssl) != 1) {
+    if (error) *error = "handshake failed: " + openssl_error();
+  } else if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+    if (error) {
+      *error = std::string("kernel did not take over ") + SSL_get_version(ssl) + " " +
+               SSL_get_cipher_name(ssl);
+    }
+  } else if (SSL_has_pending(ssl)) {
+    // Records OpenSSL read before the keys moved would never reach us.
+    if (error) *error = "data arrived before the kernel took over";
+  } else {
+    ok = true;
+  }
+  // Frees the SSL without sending close_notify; the socket stays open.
+  SSL_free(ssl);
+  set_timeouts(fd, std::chrono::milliseconds(0));
+  return ok;
+}
+
+}  // namespace quiz::server
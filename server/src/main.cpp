@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <chrono>
 #include <csignal>
+#include <cstdlib>
 #include <filesystem>
 #include <iostream>
 #include <thread>
@@ -7,17 +9,27 @@
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 
+#include "common/data_writer.hpp"
+#include "server/affinity.hpp"
 #include "server/auth.hpp"
+#include "server/request_context.hpp"
 #include "server/server.hpp"
+#include "server/single_flight.hpp"
 #include "server/room.hpp"
+using quiz::Action;
+using quiz::ActionId;
+using quiz::DataWriter;
 using quiz::Message;
 using quiz::MessageType;
 using quiz::Status;
 using quiz::server::AuthService;
+using quiz::server::DeferredReply;
 using quiz::server::RoomManager;
 using quiz::server::Server;
 using quiz::server::RoomSettings;
 using quiz::server::RoomResult;
+using quiz::server::UserHistory;
+using quiz::server::SingleFlight;
 
 namespace {
 std::atomic<bool> g_stop{false};
@@ -42,6 +54,107 @@ Message make_error_response(const Message& req,
   return resp;
 }
 
+// Result and history replies can run to thousands of rows, so they are
+// written from the row structs at encode time instead of through a JSON
+// tree. Keys are in sorted order, as a json object would emit them.
+void write_room_results(DataWriter& w, const RoomResult& res) {
+  w.begin_object(res.has_statistics ? 2 : 1);
+  w.key("participants");
+  w.begin_array(res.rows.size());
+  for (const auto& r : res.rows) {
+    w.begin_object(7);
+    w.key("correct");
+    w.integer(r.correct);
+    w.key("full_name");
+    w.string(r.full_name);
+    w.key("score");
+    w.real(r.score);
+    w.key("submitted_at");
+    w.number(r.submitted_at);
+    w.key("total");
+    w.integer(r.total);
+    w.key("user_id");
+    w.integer(r.user_id);
+    w.key("username");
+    w.string(r.username);
+    w.end_object();
+  }
+  w.end_array();
+  if (res.has_statistics) {
+    w.key("statistics");
+    w.begin_object(4);
+    w.key("average_score");
+    w.real(res.average_score);
+    w.key("highest_score");
+    w.real(res.highest_score);
+    w.key("lowest_score");
+    w.real(res.lowest_score);
+    w.key("pass_rate");
+    w.real(res.pass_rate);
+    w.end_object();
+  }
+  w.end_object();
+}
+
+void write_user_history(DataWriter& w, const UserHistory& hist) {
+  w.begin_object(3);
+  w.key("average_score");
+  w.real(hist.avg_score);
+  w.key("exams");
+  w.begin_array(hist.exams.size());
+  for (const auto& e : hist.exams) {
+    w.begin_object(e.room_name ? 7 : 6);
+    w.key("correct");
+    w.integer(e.correct);
+    w.key("exam_id");
+    w.integer(e.exam_id);
+    w.key("room_id");
+    w.integer(e.room_id);
+    if (e.room_name) {
+      w.key("room_name");
+      w.string(*e.room_name);
+    }
+    w.key("score");
+    w.real(e.score);
+    w.key("submitted_at");
+    w.number(e.submitted_at);
+    w.key("total");
+    w.integer(e.total);
+    w.end_object();
+  }
+  w.end_array();
+  w.key("practices");
+  w.begin_array(hist.practices.size());
+  for (const auto& p : hist.practices) {
+    const bool has_settings = !p.settings_json.empty();
+    w.begin_object(has_settings ? 6 : 5);
+    w.key("correct");
+    w.integer(p.correct);
+    w.key("practice_id");
+    w.integer(p.practice_id);
+    w.key("score");
+    w.real(p.score);
+    if (has_settings) {
+      w.key("settings");
+      w.raw_json(p.settings_json);
+    }
+    w.key("submitted_at");
+    w.number(p.submitted_at);
+    w.key("total");
+    w.integer(p.total);
+    w.end_object();
+  }
+  w.end_array();
+  w.end_object();
+}
+
+// Outcome of a GET_ROOM_DETAILS lookup, shared by coalesced requests.
+struct RoomDetailsReply {
+  bool ok{false};
+  std::string error;
+  nlohmann::json data;
+};
+
 Message echo_handler(const Message& req) {
   Message resp;
   resp.type = MessageType::Response;
@@ -55,6 +168,72 @@ Message echo_handler(const Message& req) {
   return resp;
 }
 
+// IMPORT_QUESTIONS: an admin uploads a question bank as a chunked stream,
+// each chunk carrying {"questions": [...]}. Chunks are stored as they
+// arrive, one transaction each, so a rejected chunk keeps the earlier ones.
+class QuestionImport : public quiz::server::StreamConsumer {
+ public:
+  QuestionImport(AuthService& auth, RoomManager& rooms) : auth_(auth), rooms_(rooms) {}
+
+  std::optional<Message> on_chunk(const Message& chunk) override {
+    std::string error;
+    if (action_.empty()) {
+      auto session = auth_.validate(chunk.session_id, &error);
+      if (!session) return make_error_response(chunk, "UNAUTHORIZED", error);
+      if (session->role != "ADMIN") return make_error_response(chunk, "FORBIDDEN", "admin only");
+      action_ = chunk.action;
+    }
+    auto it = chunk.data.find("questions");
+    if (it == chunk.data.end()) {
+      return make_error_response(chunk, "INVALID_REQUEST", "questions required");
+    }
+    auto added = rooms_.add_questions(*it, &error);
+    if (!added) {
+      return make_error_response(chunk, "IMPORT_FAILED",
+                                 error + " (" + std::to_string(imported_) +
+                                     " imported by earlier chunks)");
+    }
+    imported_ += *added;
+    ++chunks_;
+    return std::nullopt;
+  }
+
+  Message finish() override {
+    Message resp;
+    resp.type = MessageType::Response;
+    resp.action = action_;
+    resp.timestamp = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+    resp.status = Status::Success;
+    resp.data = {{"imported", imported_}, {"chunks", chunks_}};
+    return resp;
+  }
+
+ private:
+  AuthService& auth_;
+  RoomManager& rooms_;
+  Action action_;  // set once the first chunk is authorized
+  int imported_{0};
+  int chunks_{0};
+};
+
+// Reads an optional core list from the environment; bad lists are ignored.
+void load_cpu_list(const char* var, std::vector<int>& cpus) {
+  const char* spec = std::getenv(var);
+  if (!spec) return;
+  std::string error;
+  if (!quiz::server::parse_cpu_list(spec, cpus, &error)) {
+    std::cerr << "[server] ignoring " << var << ": " << error << "\n";
+    cpus.clear();
+    return;
+  }
+  std::cout << "[server] " << var << "=" << spec;
+  if (!cpus.empty()) std::cout << " (node " << quiz::server::numa_node_of_cpu(cpus.front()) << ")";
+  std::cout << "\n";
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -67,10 +246,42 @@ int main(int argc, char** argv) {
   if (argc > 2) {
     db_path = argv[2];
   }
-
-  Server server(host, port, 4);
-  AuthService auth(db_path);
+  // Handlers mostly wait on SQLite, so the dispatch pool may grow well past
+  // the core count; it starts small and sizes itself within these bounds.
+  const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  quiz::server::PipelineConfig pipeline;
+  pipeline.dispatch_threads = std::max<std::size_t>(2, cores);
+  pipeline.dispatch_max_threads = std::max<std::size_t>(pipeline.dispatch_threads, cores * 8);
+  if (argc > 3) {
+    pipeline.dispatch_threads = std::max(1, std::stoi(argv[3]));
+  }
+  if (argc > 4) {
+    pipeline.dispatch_max_threads = std::max(1, std::stoi(argv[4]));
+  }
+  std::cout << "[server] dispatch workers: " << pipeline.dispatch_threads << ".."
+            << std::max(pipeline.dispatch_threads, pipeline.dispatch_max_threads) << "\n";
+  // Optional pinning, e.g. QUIZ_REACTOR_CPUS=0-1 QUIZ_WORKER_CPUS=2-7. Keeping
+  // reactors and workers on one NUMA node avoids cross-node buffer traffic.
+  load_cpu_list("QUIZ_REACTOR_CPUS", pipeline.reactor_cpus);
+  load_cpu_list("QUIZ_WORKER_CPUS", pipeline.dispatch_cpus);
+
+  Server server(host, port, pipeline);
+  // Each password hash holds a core and 16 MiB for tens of milliseconds; a
+  // quarter of the cores is the most a login storm may take from exams.
+  const std::size_t hash_threads = std::max<std::size_t>(1, cores / 4);
+  AuthService auth(db_path, hash_threads, hash_threads * 16);
+  // QUIZ_SIGNED_SESSIONS=1: logins get HMAC-signed tokens that handlers check
+  // without SQLite. Keys rotate hourly and live in memory, so a restart
+  // logs everyone out.
+  if (const char* signed_sessions = std::getenv("QUIZ_SIGNED_SESSIONS");
+      signed_sessions && std::string(signed_sessions) == "1") {
+    auth.enable_signed_tokens(std::chrono::hours(1));
+    std::cout << "[server] signed session tokens enabled\n";
+  }
   RoomManager room_mgr(db_path);
+  // Participants poll room details in bursts; identical concurrent reads
+  // share one query.
+  SingleFlight<RoomDetailsReply> room_details_flight;
   // Ensure logs dir exists and set up rotating logger.
   std::filesystem::create_directories("logs");
   auto logger = spdlog::rotating_logger_mt("server", "logs/server.log", 1024 * 1024 * 5, 3);
@@ -78,10 +289,13 @@ int main(int argc, char** argv) {
   spdlog::set_level(spdlog::level::info);
   spdlog::set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%l] %v");
 
-  server.register_handler("ECHO", echo_handler);
+  server.register_handler(ActionId::Echo, echo_handler);
 
   std::cout << "[DEBUG] Registering REGISTER handler...\n";
-  server.register_handler("REGISTER", [&auth](const Message& req) {
+  // Both hash the password, so they run on the auth service's password stage
+  // and the worker moves on; when that queue is full they are refused.
+  server.register_deferred_handler(ActionId::Register, [&auth](const Message& req,
+                                                               DeferredReply reply) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -95,23 +309,38 @@ int main(int argc, char** argv) {
     if (!d.contains("username") || !d.contains("password") || !d.contains("full_name")) {
       resp.error_code = "INVALID_REQUEST";
       resp.error_message = "Missing required fields";
-      return resp;
+      reply(std::move(resp));
+      return;
     }
-    std::string error;
-    auto user_id = auth.register_user(d.value("username", ""), d.value("password", ""),
-                                      d.value("full_name", ""), d.value("email", ""),
-                                      "STUDENT", &error);
-    if (!user_id) {
-      resp.error_code = "REGISTER_FAILED";
-      resp.error_message = error;
-      return resp;
+    const bool queued = auth.submit([&auth, reply, resp, username = d.value("username", ""),
+                                     password = d.value("password", ""),
+                                     full_name = d.value("full_name", ""),
+                                     email = d.value("email", "")]() mutable {
+      if (reply.context().expired()) {
+        reply.drop();
+        return;
+      }
+      std::string error;
+      auto user_id = auth.register_user(username, password, full_name, email, "STUDENT", &error);
+      if (!user_id) {
+        resp.error_code = "REGISTER_FAILED";
+        resp.error_message = error;
+        reply(std::move(resp));
+        return;
+      }
+      resp.status = Status::Success;
+      resp.data = {{"user_id", *user_id}};
+      reply(std::move(resp));
+    });
+    if (!queued) {
+      resp.error_code = "SERVER_BUSY";
+      resp.error_message = "Too many logins in progress, try again later";
+      reply(std::move(resp));
     }
-    resp.status = Status::Success;
-    resp.data = {{"user_id", *user_id}};
-    return resp;
   });
 
-  server.register_handler("LOGIN", [&auth](const Message& req) {
+  server.register_deferred_handler(ActionId::Login, [&auth](const Message& req,
+                                                            DeferredReply reply) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -125,26 +354,40 @@ int main(int argc, char** argv) {
     if (!d.contains("username") || !d.contains("password")) {
       resp.error_code = "INVALID_REQUEST";
       resp.error_message = "Missing username/password";
-      return resp;
+      reply(std::move(resp));
+      return;
     }
-    std::string error;
-    auto session = auth.login(d.value("username", ""), d.value("password", ""), 3600, &error);
-    if (!session) {
-      resp.error_code = "LOGIN_FAILED";
-      resp.error_message = error;
-      return resp;
+    const bool queued = auth.submit([&auth, reply, resp, username = d.value("username", ""),
+                                     password = d.value("password", "")]() mutable {
+      if (reply.context().expired()) {
+        reply.drop();
+        return;
+      }
+      std::string error;
+      auto session = auth.login(username, password, 3600, &error);
+      if (!session) {
+        resp.error_code = "LOGIN_FAILED";
+        resp.error_message = error;
+        reply(std::move(resp));
+        return;
+      }
+      resp.status = Status::Success;
+      resp.session_id = session->token;
+      resp.data = {{"user_id", session->user_id},
+                   {"username", session->username},
+                   {"role", session->role},
+                   {"expires_at", session->expires_at},
+                   {"session_id", session->token}};
+      reply(std::move(resp));
+    });
+    if (!queued) {
+      resp.error_code = "SERVER_BUSY";
+      resp.error_message = "Too many logins in progress, try again later";
+      reply(std::move(resp));
     }
-    resp.status = Status::Success;
-    resp.session_id = session->token;
-    resp.data = {{"user_id", session->user_id},
-                 {"username", session->username},
-                 {"role", session->role},
-                 {"expires_at", session->expires_at},
-                 {"session_id", session->token}};
-    return resp;
   });
 
-  server.register_handler("LOGOUT", [&auth](const Message& req) {
+  server.register_handler(ActionId::Logout, [&auth](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -175,7 +418,7 @@ int main(int argc, char** argv) {
   });
 
   // CREATE_ROOM
-  server.register_handler("CREATE_ROOM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::CreateRoom, [&auth, &room_mgr](const Message& req) {
     std::cout << "[DEBUG-CR] CREATE_ROOM handler started\n";
     auto now = static_cast<std::uint64_t>(
         std::chrono::duration_cast<std::chrono::seconds>(
@@ -245,7 +488,7 @@ int main(int argc, char** argv) {
   });
 
   // LIST_ROOMS
-  server.register_handler("LIST_ROOMS", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::ListRooms, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -286,7 +529,7 @@ int main(int argc, char** argv) {
   });
 
   // JOIN_ROOM
-  server.register_handler("JOIN_ROOM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::JoinRoom, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -321,7 +564,7 @@ int main(int argc, char** argv) {
   });
 
   // START_EXAM
-  server.register_handler("START_EXAM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::StartExam, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -355,7 +598,7 @@ int main(int argc, char** argv) {
   });
 
   // GET_EXAM_PAPER
-  server.register_handler("GET_EXAM_PAPER", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::GetExamPaper, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -394,7 +637,7 @@ int main(int argc, char** argv) {
   });
 
   // GET_TIMER_STATUS
-  server.register_handler("GET_TIMER_STATUS", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::GetTimerStatus, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -457,7 +700,7 @@ int main(int argc, char** argv) {
   });
 
   // SUBMIT_ANSWER (patch)
-  server.register_handler("SUBMIT_ANSWER", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::SubmitAnswer, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -508,7 +751,7 @@ int main(int argc, char** argv) {
   });
 
   // SUBMIT_EXAM (final)
-  server.register_handler("SUBMIT_EXAM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::SubmitExam, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -564,7 +807,7 @@ int main(int argc, char** argv) {
   });
 
   // START_PRACTICE
-  server.register_handler("START_PRACTICE", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::StartPractice, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -606,7 +849,7 @@ int main(int argc, char** argv) {
   });
 
   // SUBMIT_PRACTICE
-  server.register_handler("SUBMIT_PRACTICE", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::SubmitPractice, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -657,7 +900,7 @@ int main(int argc, char** argv) {
   });
 
   // GET_ROOM_RESULTS
-  server.register_handler("GET_ROOM_RESULTS", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::GetRoomResults, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -680,34 +923,72 @@ int main(int argc, char** argv) {
       resp.error_message = "room_id required";
       return resp;
     }
-    auto res = room_mgr.get_room_results(room_id, &error);
+    // Statistics are optional; skip them when the client is about to give up.
+    const auto* ctx = quiz::server::current_request();
+    bool with_stats = !ctx || ctx->has_budget(std::chrono::milliseconds(200));
+    auto res = room_mgr.get_room_results(room_id, &error, with_stats);
     if (!res) {
       resp.error_code = "RESULT_FAILED";
       resp.error_message = error;
       return resp;
     }
-    nlohmann::json arr = nlohmann::json::array();
-    for (const auto& r : res->rows) {
-      arr.push_back({{"user_id", r.user_id},
-                     {"username", r.username},
-                     {"full_name", r.full_name},
-                     {"score", r.score},
-                     {"correct", r.correct},
-                     {"total", r.total},
-                     {"submitted_at", r.submitted_at}});
-    }
     resp.status = Status::Success;
-    resp.data = {{"participants", arr},
-                 {"statistics",
-                  {{"average_score", res->average_score},
-                   {"highest_score", res->highest_score},
-                   {"lowest_score", res->lowest_score},
-                   {"pass_rate", res->pass_rate}}}};
+    resp.write_data = [res = std::move(*res)](DataWriter& w) { write_room_results(w, res); };
     return resp;
   });
 
+  // EXPORT_ROOM_RESULTS: GET_ROOM_RESULTS for rooms of any size, streamed as
+  // batches of {"participants": [...]} and ended by the totals.
+  server.register_stream_handler(
+      ActionId::ExportRoomResults,
+      [&auth, &room_mgr](const Message& req, quiz::server::ChunkWriter& out) {
+        constexpr std::size_t kRowsPerChunk = 500;
+
+        std::string error;
+        auto session = auth.validate(req.session_id, &error);
+        if (!session) return make_error_response(req, "UNAUTHORIZED", error);
+        int room_id = req.data.value("room_id", -1);
+        if (room_id <= 0) return make_error_response(req, "INVALID_REQUEST", "room_id required");
+
+        std::size_t participants = 0;
+        bool aborted = false;
+        auto res = room_mgr.export_room_results(
+            room_id, kRowsPerChunk,
+            [&](const std::vector<quiz::server::RoomResultRow>& rows) {
+              nlohmann::json batch = nlohmann::json::array();
+              for (const auto& r : rows) {
+                batch.push_back({{"user_id", r.user_id},
+                                 {"username", r.username},
+                                 {"full_name", r.full_name},
+                                 {"score", r.score},
+                                 {"correct", r.correct},
+                                 {"total", r.total},
+                                 {"submitted_at", r.submitted_at}});
+              }
+              participants += rows.size();
+              aborted = !out.write({{"participants", std::move(batch)}});
+              return !aborted;
+            },
+            &error);
+        if (aborted) return make_error_response(req, "STREAM_ABORTED", "client stopped reading");
+        if (!res) return make_error_response(req, "RESULT_FAILED", error);
+
+        Message resp;
+        resp.type = MessageType::Response;
+        resp.action = req.action;
+        resp.status = Status::Success;
+        resp.data = {{"participant_count", participants}, {"chunks", out.chunks_sent()}};
+        if (res->has_statistics) {
+          resp.data["statistics"] = {{"average_score", res->average_score},
+                                     {"highest_score", res->highest_score},
+                                     {"lowest_score", res->lowest_score},
+                                     {"pass_rate", res->pass_rate}};
+        }
+        return resp;
+      });
+
   // GET_ROOM_DETAILS
-  server.register_handler("GET_ROOM_DETAILS", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::GetRoomDetails, [&auth, &room_mgr, &room_details_flight](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -730,43 +1011,54 @@ int main(int argc, char** argv) {
       resp.error_message = "room_id required";
       return resp;
     }
-    auto details = room_mgr.get_room_details(room_id, &error);
-    if (!details) {
+
+    // The reply depends only on room_id; the session check above stays per request.
+    auto key = quiz::server::single_flight_key(req.action.str(), {{"room_id", room_id}});
+    auto reply = room_details_flight.run(key, [&room_mgr, room_id] {
+      RoomDetailsReply out;
+      auto details = room_mgr.get_room_details(room_id, &out.error);
+      if (!details) return out;
+
+      // Build participants array
+      nlohmann::json participants = nlohmann::json::array();
+      for (const auto& p : details->participants) {
+        participants.push_back({
+          {"user_id", p.user_id},
+          {"username", p.username},
+          {"full_name", p.full_name},
+          {"status", p.status},
+          {"joined_at", p.joined_at}
+        });
+      }
+
+      out.ok = true;
+      out.data = {
+        {"room_id", details->info.id},
+        {"room_code", details->info.code},
+        {"room_name", details->info.name},
+        {"description", details->info.description},
+        {"duration_seconds", details->info.duration_seconds},
+        {"status", details->info.status},
+        {"creator_id", details->info.creator_id},
+        {"creator_name", details->creator_name},
+        {"participant_count", details->info.participant_count},
+        {"participants", participants}
+      };
+      return out;
+    });
+    if (!reply.ok) {
       resp.error_code = "DETAILS_FAILED";
-      resp.error_message = error;
+      resp.error_message = reply.error;
       return resp;
     }
 
-    // Build participants array
-    nlohmann::json participants = nlohmann::json::array();
-    for (const auto& p : details->participants) {
-      participants.push_back({
-        {"user_id", p.user_id},
-        {"username", p.username},
-        {"full_name", p.full_name},
-        {"status", p.status},
-        {"joined_at", p.joined_at}
-      });
-    }
-
     resp.status = Status::Success;
-    resp.data = {
-      {"room_id", details->info.id},
-      {"room_code", details->info.code},
-      {"room_name", details->info.name},
-      {"description", details->info.description},
-      {"duration_seconds", details->info.duration_seconds},
-      {"status", details->info.status},
-      {"creator_id", details->info.creator_id},
-      {"creator_name", details->creator_name},
-      {"participant_count", details->info.participant_count},
-      {"participants", participants}
-    };
+    resp.data = std::move(reply.data);
     return resp;
   });
 
   // DELETE_ROOM
-  server.register_handler("DELETE_ROOM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::DeleteRoom, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -804,7 +1096,7 @@ int main(int argc, char** argv) {
   });
 
   // FINISH_ROOM
-  server.register_handler("FINISH_ROOM", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::FinishRoom, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -842,7 +1134,7 @@ int main(int argc, char** argv) {
   });
 
   // GET_USER_HISTORY
-  server.register_handler("GET_USER_HISTORY", [&auth, &room_mgr](const Message& req) {
+  server.register_handler(ActionId::GetUserHistory, [&auth, &room_mgr](const Message& req) {
     Message resp;
     resp.type = MessageType::Response;
     resp.action = req.action;
@@ -870,14 +1162,63 @@ int main(int argc, char** argv) {
       return resp;
     }
     resp.status = Status::Success;
-    resp.data = {{"exams", hist->exams},
-                 {"practices", hist->practices},
-                 {"average_score", hist->avg_score}};
+    resp.write_data = [hist = std::move(*hist)](DataWriter& w) { write_user_history(w, hist); };
     return resp;
   });
 
+  // IMPORT_QUESTIONS (admin only, chunked upload)
+  server.register_stream_consumer(ActionId::ImportQuestions, [&auth, &room_mgr] {
+    return std::make_unique<QuestionImport>(auth, room_mgr);
+  });
+
+  // GET_SERVER_STATS (admin only, ignores data)
+  server.register_handler(ActionId::GetServerStats, [&auth, &server, &room_mgr, &room_details_flight](const Message& req) {
+    Message resp;
+    resp.type = MessageType::Response;
+    resp.action = req.action;
+    resp.timestamp = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+    resp.status = Status::Error;
+
+    std::string error;
+    auto session = auth.validate(req.session_id, &error);
+    if (!session) {
+      resp.error_code = "UNAUTHORIZED";
+      resp.error_message = error;
+      return resp;
+    }
+    if (session->role != "ADMIN") {
+      resp.error_code = "FORBIDDEN";
+      resp.error_message = "admin only";
+      return resp;
+    }
+    resp.status = Status::Success;
+    resp.data = server.stats();
+    resp.data["single_flight"] = {{"GET_ROOM_DETAILS", room_details_flight.stats()}};
+    resp.data["room_actors"] = room_mgr.stats();
+    resp.data["auth"] = auth.stats();
+    return resp;
+  }, quiz::server::HandlerData::EnvelopeOnly);
+
   std::signal(SIGINT, signal_handler);
   std::signal(SIGTERM, signal_handler);
+  // A client vanishing mid-response must not kill the server.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // Optional TLS offloaded to the kernel, e.g. QUIZ_TLS_CERT=server.pem
+  // QUIZ_TLS_KEY=server.key. Clients on it may negotiate away our own AES.
+  const char* tls_cert = std::getenv("QUIZ_TLS_CERT");
+  const char* tls_key = std::getenv("QUIZ_TLS_KEY");
+  if (tls_cert || tls_key) {
+    std::string error = "set both QUIZ_TLS_CERT and QUIZ_TLS_KEY";
+    if (!tls_cert || !tls_key || !server.enable_tls(tls_cert, tls_key, &error)) {
+      std::cerr << "[server] cannot enable TLS: " << error << "\n";
+      return 1;
+    }
+    std::cout << "[server] kernel TLS enabled\n";
+  }
 
   if (!server.start()) {
     std::cerr << "[server] failed to start\n";
@@ -0,0 +1,250 @@
+#include "server/reactor.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include "server/affinity.hpp"
+#include "server/server.hpp"
+
+namespace quiz::server {
+
+namespace {
+
+constexpr int kMaxEvents = 64;
+
+std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - since)
+          .count());
+}
+
+}  // namespace
+
+ReactorShard::ReactorShard(std::size_t index, int cpu)
+    : index_(index), cpu_(cpu), node_(cpu >= 0 ? numa_node_of_cpu(cpu) : -1) {}
+
+ReactorShard::~ReactorShard() {
+  stop();
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+  if (epoll_fd_ >= 0) ::close(epoll_fd_);
+}
+
+bool ReactorShard::start() {
+  if (running_.load()) return true;
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::perror("epoll_create1");
+    return false;
+  }
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    std::perror("eventfd");
+    return false;
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = wake_fd_;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+    std::perror("epoll_ctl");
+    return false;
+  }
+  running_.store(true);
+  thread_ = std::thread(&ReactorShard::loop, this);
+  return true;
+}
+
+void ReactorShard::stop() {
+  if (!running_.exchange(false)) return;
+  post([] {});
+  if (thread_.joinable()) thread_.join();
+  conns_.clear();
+  conn_count_.store(0);
+}
+
+void ReactorShard::post(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mtx_);
+    mailbox_.push_back(std::move(fn));
+  }
+  std::uint64_t one = 1;
+  ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+  (void)n;
+}
+
+void ReactorShard::drain_mailbox() {
+  std::uint64_t counter = 0;
+  ssize_t n = ::read(wake_fd_, &counter, sizeof(counter));
+  (void)n;
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mtx_);
+    tasks.swap(mailbox_);
+  }
+  for (auto& t : tasks) t();
+}
+
+void ReactorShard::adopt(std::shared_ptr<Connection> conn) {
+  conn_count_.fetch_add(1);
+  conn->shard_.store(this);
+  post([this, conn = std::move(conn)] { attach(conn); });
+}
+
+void ReactorShard::watch_writable(std::shared_ptr<Connection> conn) {
+  post([this, conn = std::move(conn)] {
+    if (owns(conn)) {
+      update_events(*conn);
+    } else if (conn->write_pending() && !conn->reading_) {
+      // Detached after EOF while a response was still being produced.
+      conn_count_.fetch_add(1);
+      attach(conn);
+    }
+  });
+}
+
+void ReactorShard::retire(std::shared_ptr<Connection> conn) {
+  post([this, conn = std::move(conn)] {
+    if (owns(conn)) detach(conn->fd());
+    if (conn->close_fd()) conn->server_->remove_connection(conn);
+  });
+}
+
+bool ReactorShard::owns(const std::shared_ptr<Connection>& conn) const {
+  auto it = conns_.find(conn->fd());
+  return it != conns_.end() && it->second == conn;
+}
+
+void ReactorShard::update_events(Connection& conn) {
+  std::uint32_t events = (conn.reading_ ? (EPOLLIN | EPOLLRDHUP) : 0u) |
+                         (conn.write_pending() ? EPOLLOUT : 0u);
+  if (events == conn.events_) return;
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = conn.fd();
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd(), &ev) == 0) conn.events_ = events;
+}
+
+void ReactorShard::attach(const std::shared_ptr<Connection>& conn) {
+  epoll_event ev{};
+  ev.events = (conn->reading_ ? (EPOLLIN | EPOLLRDHUP) : 0u) |
+              (conn->write_pending() ? EPOLLOUT : 0u);
+  ev.data.fd = conn->fd();
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd(), &ev) < 0) {
+    std::perror("epoll_ctl add");
+    conn_count_.fetch_sub(1);
+    conn->stop();
+    conn->server_->remove_connection(conn);
+    return;
+  }
+  conn->events_ = ev.events;
+  conn->busy_mark_ = conn->busy_ns_;
+  // Migrated connections arrive idle; drop the old shard's buffer so the
+  // next read allocates it from this shard's node.
+  if (cpu_ >= 0 && conn->inbuf_.empty()) conn->inbuf_.shrink_to_fit();
+  conns_[conn->fd()] = conn;
+}
+
+void ReactorShard::detach(int fd) {
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  conns_.erase(fd);
+  conn_count_.fetch_sub(1);
+}
+
+void ReactorShard::migrate_to(ReactorShard& target, std::size_t max_moves,
+                              std::uint64_t busy_budget_ns) {
+  post([this, &target, max_moves, busy_budget_ns] {
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<Connection>>> candidates;
+    for (auto& [fd, conn] : conns_) {
+      if (!conn->idle()) continue;
+      candidates.emplace_back(conn->busy_ns_ - conn->busy_mark_, conn);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::size_t moved = 0;
+    std::uint64_t moved_ns = 0;
+    for (auto& [recent_ns, conn] : candidates) {
+      if (moved >= max_moves || moved_ns >= busy_budget_ns) break;
+      detach(conn->fd());
+      target.adopt(conn);
+      moved_ns += recent_ns;
+      ++moved;
+    }
+    if (moved > 0) {
+      std::cout << "[server] rebalance: moved " << moved << " connection(s) from shard "
+                << index_ << " to shard " << target.index() << " (~" << moved_ns / 1000
+                << " us recent load)\n";
+    }
+  });
+}
+
+void ReactorShard::roll_window() {
+  post([this] {
+    for (auto& [fd, conn] : conns_) conn->busy_mark_ = conn->busy_ns_;
+  });
+}
+
+ShardLoad ReactorShard::sample_load() {
+  ShardLoad load;
+  load.shard = index_;
+  load.connections = conn_count_.load();
+  load.busy_ns = busy_ns_.exchange(0);
+  load.frames = frames_.exchange(0);
+  return load;
+}
+
+void ReactorShard::loop() {
+  if (cpu_ >= 0) {
+    std::string error;
+    if (!pin_current_thread(cpu_, &error)) {
+      std::cerr << "[server] reactor shard " << index_ << ": " << error << "\n";
+    }
+  }
+  epoll_event events[kMaxEvents];
+  while (running_.load()) {
+    int n = ::epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        drain_mailbox();
+        continue;
+      }
+      auto it = conns_.find(fd);
+      if (it == conns_.end()) continue;
+      auto conn = it->second;
+      const std::uint32_t ready = events[i].events;
+
+      if (ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn->flush();
+      if (conn->reading_ && (ready & ~EPOLLOUT)) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::uint64_t frames = 0;
+        conn->reading_ = conn->on_readable(frames);
+        std::uint64_t spent = elapsed_ns(t0);
+        conn->busy_ns_ += spent;
+        busy_ns_.fetch_add(spent);
+        frames_.fetch_add(frames);
+      }
+
+      if (conn->reading_ || conn->write_pending()) {
+        update_events(*conn);
+      } else {
+        detach(fd);
+        conn->close_when_done();
+      }
+    }
+  }
+}
+
+}  // namespace quiz::server
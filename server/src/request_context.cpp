@@ -0,0 +1,56 @@
+#include "server/request_context.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace quiz::server {
+
+namespace {
+thread_local const RequestContext* t_current = nullptr;
+
+// Covers a typical request (a question paper, a result page) without going
+// to the heap; larger requests spill into upstream blocks.
+constexpr std::size_t kArenaInitialBytes = 64 * 1024;
+
+std::vector<std::byte>& arena_buffer() {
+  thread_local std::vector<std::byte> buffer(kArenaInitialBytes);
+  return buffer;
+}
+}  // namespace
+
+bool RequestContext::expired() const {
+  return deadline && std::chrono::steady_clock::now() >= *deadline;
+}
+
+std::optional<std::int64_t> RequestContext::remaining_ms() const {
+  if (!deadline) return std::nullopt;
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      *deadline - std::chrono::steady_clock::now());
+  return left.count() > 0 ? left.count() : 0;
+}
+
+bool RequestContext::has_budget(std::chrono::milliseconds needed) const {
+  auto left = remaining_ms();
+  return !left || *left >= needed.count();
+}
+
+const RequestContext* current_request() {
+  return t_current;
+}
+
+std::pmr::memory_resource* request_memory() {
+  return t_current && t_current->memory ? t_current->memory : std::pmr::get_default_resource();
+}
+
+ScopedRequestContext::ScopedRequestContext(const RequestContext& ctx) : previous_(t_current) {
+  t_current = &ctx;
+}
+
+ScopedRequestContext::~ScopedRequestContext() {
+  t_current = previous_;
+}
+
+ScopedRequestArena::ScopedRequestArena()
+    : resource_(arena_buffer().data(), arena_buffer().size()) {}
+
+}  // namespace quiz::server
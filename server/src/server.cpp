@@ -5,12 +5,18 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
+#include "common/aes_crypto.hpp"
 #include "common/codec.hpp"
+#include "common/compress.hpp"
+#include "server/request_context.hpp"
 
 namespace quiz::server {
 
@@ -65,12 +71,12 @@ std::string peer_addr(int fd) {
   return "unknown";
 }
 
-Message make_error(const Message& req,
+Message make_error(const Action& action,
                    const std::string& code,
                    const std::string& msg) {
   Message resp;
   resp.type = MessageType::Response;
-  resp.action = req.action;
+  resp.action = action;
   resp.timestamp = static_cast<std::uint64_t>(
       std::chrono::duration_cast<std::chrono::seconds>(
           std::chrono::system_clock::now().time_since_epoch())
@@ -81,38 +87,220 @@ Message make_error(const Message& req,
   return resp;
 }
 
+Message make_error(const Message& req, const std::string& code, const std::string& msg) {
+  return make_error(req.action, code, msg);
+}
+
 }  // namespace
 
-Server::Server(std::string host, uint16_t port, std::size_t workers)
-    : host_(std::move(host)), port_(port), workers_(workers) {}
+namespace {
+
+PipelineConfig default_pipeline(std::size_t workers, std::size_t reactors) {
+  PipelineConfig config;
+  config.dispatch_threads = workers;
+  config.reactors = reactors;
+  return config;
+}
+
+ThreadPoolOptions dispatch_options(const PipelineConfig& config) {
+  ThreadPoolOptions options;
+  options.min_workers = config.dispatch_threads;
+  options.max_workers = std::max(config.dispatch_threads, config.dispatch_max_threads);
+  options.capacity = config.dispatch_queue;
+  options.cpus = config.dispatch_cpus;
+  return options;
+}
+
+// Protocol negotiation: the client lists the frame versions it speaks and
+// gets back the highest one both sides support. On v2 it may also list
+// envelope encodings in order of preference; the first one this server
+// knows is chosen, and offer DEFLATE compression with its dictionary id and
+// ciphers in order of preference: AES-256-GCM, which takes an X25519
+// "key_share" and is answered with the server's, or NONE when the connection
+// is already under kernel TLS. Always sent as v1, so old servers simply
+// answer UNKNOWN_ACTION and the client stays on v1 JSON.
+Message handle_hello(const Message& req) {
+  std::uint8_t chosen = kProtocolV1;
+  auto it = req.data.find("protocol_versions");
+  if (it != req.data.end() && it->is_array()) {
+    for (const auto& v : *it) {
+      if (v.is_number_unsigned() && v.get<std::uint64_t>() <= kProtocolV2) {
+        chosen = std::max(chosen, static_cast<std::uint8_t>(v.get<std::uint64_t>()));
+      }
+    }
+  }
+  Encoding encoding = Encoding::Json;
+  auto offered = req.data.find("encodings");
+  if (chosen == kProtocolV2 && offered != req.data.end() && offered->is_array()) {
+    for (const auto& name : *offered) {
+      if (!name.is_string()) continue;
+      if (auto known = encoding_from_string(name.get<std::string>())) {
+        encoding = *known;
+        break;
+      }
+    }
+  }
+  Message resp;
+  resp.type = MessageType::Response;
+  resp.action = req.action;
+  resp.status = Status::Success;
+  resp.data = {{"protocol_version", chosen},
+               {"encoding", to_string(encoding)},
+               {"encodings", {"JSON", "MSGPACK", "CBOR"}}};
+  // Compression needs v2 flags and the same trained dictionary on both ends.
+  auto compression = req.data.find("compression");
+  if (chosen == kProtocolV2 && compression != req.data.end() && compression->is_array() &&
+      std::find(compression->begin(), compression->end(), "DEFLATE") != compression->end() &&
+      req.data.value("dictionary_id", 0u) == compression_dictionary_id()) {
+    resp.data["compression"] = "DEFLATE";
+    resp.data["dictionary_id"] = compression_dictionary_id();
+  }
+  // Either choice is signalled per frame by a v2 flag. GCM keys are agreed
+  // here, per connection, from the client's "key_share".
+  auto ciphers = req.data.find("ciphers");
+  if (chosen == kProtocolV2 && ciphers != req.data.end() && ciphers->is_array()) {
+    const auto* ctx = current_request();
+    for (const auto& name : *ciphers) {
+      if (name == "NONE" && ctx && ctx->kernel_tls) {
+        resp.data["cipher"] = name;
+        break;
+      }
+      if (name != "AES-256-GCM" || !ctx || !ctx->connection) continue;
+      auto share = req.data.find("key_share");
+      if (share == req.data.end() || !share->is_string()) continue;
+      KeyExchange exchange;
+      GcmKeys keys;
+      std::string error;
+      if (!exchange.ok()) {
+        error = "no X25519 key pair";
+      } else if (exchange.derive(share->get<std::string>(), false, keys, error) &&
+                 !ctx->connection->set_gcm_keys(keys)) {
+        error = "keys already agreed";
+      }
+      if (!error.empty()) {
+        std::cerr << "[server] GCM refused for " << ctx->connection->peer() << ": " << error
+                  << "\n";
+        continue;
+      }
+      resp.data["cipher"] = name;
+      resp.data["key_share"] = exchange.public_key_hex();
+      break;
+    }
+  }
+  return resp;
+}
+
+}  // namespace
+
+Server::Server(std::string host, uint16_t port, std::size_t workers, std::size_t reactors)
+    : Server(std::move(host), port, default_pipeline(workers, reactors)) {}
+
+Server::Server(std::string host, uint16_t port, const PipelineConfig& config)
+    : host_(std::move(host)),
+      port_(port),
+      decode_stage_("decode", config.decode_threads, config.decode_queue),
+      workers_(dispatch_options(config)),
+      encode_stage_("encode", config.encode_threads, config.encode_queue) {
+  const std::size_t reactors = config.reactors == 0 ? 1 : config.reactors;
+  shards_.reserve(reactors);
+  for (std::size_t i = 0; i < reactors; ++i) {
+    const int cpu = config.reactor_cpus.empty()
+                        ? -1
+                        : config.reactor_cpus[i % config.reactor_cpus.size()];
+    shards_.push_back(std::make_unique<ReactorShard>(i, cpu));
+  }
+  register_handler(ActionId::Hello, handle_hello);
+}
 
 Server::~Server() {
   stop();
 }
 
-void Server::register_handler(const std::string& action, HandlerFn handler) {
+void Server::register_handler(const Action& action, HandlerFn handler, HandlerData data) {
+  set_handler(action, Handler{std::move(handler), data, {}, {}, {}});
+}
+
+void Server::register_stream_handler(const Action& action, StreamHandlerFn handler) {
+  set_handler(action, Handler{{}, HandlerData::Parsed, std::move(handler), {}, {}});
+}
+
+void Server::register_deferred_handler(const Action& action, DeferredHandlerFn handler,
+                                       HandlerData data) {
+  set_handler(action, Handler{{}, data, {}, std::move(handler), {}});
+}
+
+void Server::register_stream_consumer(const Action& action, StreamConsumerFactory factory) {
+  set_handler(action, Handler{{}, HandlerData::Parsed, {}, {}, std::move(factory)});
+}
+
+void Server::set_handler(const Action& action, Handler handler) {
+  auto entry = std::make_shared<const Handler>(std::move(handler));
+  std::lock_guard<std::mutex> lock(handlers_mtx_);
+  if (action.known()) {
+    handlers_[static_cast<std::size_t>(action.id())] = std::move(entry);
+  } else {
+    extensions_[std::string(action.str())] = std::move(entry);
+  }
+}
+
+std::shared_ptr<const Server::Handler> Server::find_handler(const Action& action) {
   std::lock_guard<std::mutex> lock(handlers_mtx_);
-  handlers_[action] = std::move(handler);
+  if (action.known()) return handlers_[static_cast<std::size_t>(action.id())];
+  auto it = extensions_.find(action.str());
+  return it != extensions_.end() ? it->second : nullptr;
+}
+
+bool Server::enable_tls(const std::string& cert_file, const std::string& key_file,
+                        std::string* error) {
+  if (running_.load()) {
+    if (error) *error = "server already started";
+    return false;
+  }
+  tls_ = KernelTls::create(cert_file, key_file, error);
+  if (!tls_) return false;
+  handshake_stage_ = std::make_unique<Stage>("handshake", 2, 256);
+  return true;
 }
 
 bool Server::start() {
   if (running_.load()) return true;
   listen_fd_ = create_listen_socket(host_, port_);
   if (listen_fd_ < 0) return false;
+  for (auto& shard : shards_) {
+    if (!shard->start()) {
+      std::cerr << "[server] failed to start reactor shard " << shard->index() << "\n";
+      for (auto& s : shards_) s->stop();
+      ::close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+  }
   running_.store(true);
   accept_thread_ = std::thread(&Server::accept_loop, this);
+  if (shards_.size() > 1) {
+    balance_thread_ = std::thread(&Server::balance_loop, this);
+  }
   return true;
 }
 
 void Server::stop() {
   if (!running_.exchange(false)) return;
   if (listen_fd_ >= 0) {
+    ::shutdown(listen_fd_, SHUT_RDWR);  // wake the blocked accept()
     ::close(listen_fd_);
     listen_fd_ = -1;
   }
   if (accept_thread_.joinable()) accept_thread_.join();
+  // Queued handshakes see running_ cleared and close their sockets.
+  if (handshake_stage_) handshake_stage_->shutdown();
+  balance_cv_.notify_all();
+  if (balance_thread_.joinable()) balance_thread_.join();
+  for (auto& shard : shards_) shard->stop();
   close_all_connections();
+  // Upstream stages first so nothing is pushed into a stopped stage.
+  decode_stage_.shutdown();
   workers_.shutdown();
+  encode_stage_.shutdown();
 }
 
 void Server::run() {
@@ -132,60 +320,408 @@ void Server::accept_loop() {
       std::perror("accept");
       continue;
     }
-    auto conn = std::make_shared<Connection>(client_fd, this, peer_addr(client_fd));
-    {
-      std::lock_guard<std::mutex> lock(conns_mtx_);
-      connections_.push_back(conn);
+    if (!tls_) {
+      admit(client_fd, false);
+      continue;
+    }
+    bool queued = handshake_stage_->try_push([this, client_fd] {
+      // A peer that stalls mid-handshake holds a stage thread this long.
+      constexpr std::chrono::seconds kHandshakeTimeout{5};
+      std::string error;
+      if (!running_.load() || !tls_->handshake(client_fd, kHandshakeTimeout, &error)) {
+        if (running_.load()) {
+          std::cerr << "[server] TLS with " << peer_addr(client_fd) << " failed: " << error
+                    << "\n";
+        }
+        tls_failed_.fetch_add(1);
+        ::close(client_fd);
+        return;
+      }
+      tls_accepted_.fetch_add(1);
+      admit(client_fd, true);
+    });
+    if (!queued) {
+      std::cerr << "[server] handshake backlog full, dropping " << peer_addr(client_fd) << "\n";
+      tls_failed_.fetch_add(1);
+      ::close(client_fd);
+    }
+  }
+}
+
+void Server::admit(int fd, bool kernel_tls) {
+  auto conn = std::make_shared<Connection>(fd, this, peer_addr(fd), kernel_tls);
+  {
+    std::lock_guard<std::mutex> lock(conns_mtx_);
+    connections_.push_back(conn);
+  }
+  auto& shard = pick_shard();
+  shard.adopt(conn);
+  std::cout << "[server] new " << (kernel_tls ? "kTLS " : "") << "connection from "
+            << conn->peer() << " on shard " << shard.index() << "\n";
+}
+
+ReactorShard& Server::pick_shard() {
+  auto it = std::min_element(shards_.begin(), shards_.end(), [](const auto& a, const auto& b) {
+    return a->connection_count() < b->connection_count();
+  });
+  return **it;
+}
+
+void Server::balance_loop() {
+  std::unique_lock<std::mutex> lock(balance_mtx_);
+  while (running_.load()) {
+    balance_cv_.wait_for(lock, rebalance_interval_, [this] { return !running_.load(); });
+    if (!running_.load()) break;
+    rebalance_once();
+  }
+}
+
+void Server::rebalance_once() {
+  // Below this much work per window a shard is not worth relieving.
+  constexpr std::uint64_t kMinBusyNs = 5'000'000;
+  constexpr std::size_t kMaxMovesPerRound = 64;
+
+  std::vector<ShardLoad> loads;
+  loads.reserve(shards_.size());
+  for (auto& shard : shards_) loads.push_back(shard->sample_load());
+
+  auto [cold, hot] = std::minmax_element(loads.begin(), loads.end(),
+                                         [](const ShardLoad& a, const ShardLoad& b) {
+                                           return a.busy_ns < b.busy_ns;
+                                         });
+  // Only move when the hottest shard is busy and clearly ahead (>25%).
+  if (hot->busy_ns >= kMinBusyNs && hot->busy_ns * 4 > cold->busy_ns * 5 &&
+      hot->connections > 1) {
+    std::uint64_t budget = (hot->busy_ns - cold->busy_ns) / 2;
+    std::size_t max_moves = std::min(kMaxMovesPerRound, hot->connections / 2);
+    shards_[hot->shard]->migrate_to(*shards_[cold->shard], max_moves, budget);
+  }
+  for (auto& shard : shards_) shard->roll_window();
+}
+
+void Server::submit_frame(const std::shared_ptr<Connection>& conn,
+                          std::vector<std::uint8_t> frame) {
+  // The v2 header is plaintext, so priority is known before any decryption.
+  FrameHeader header;
+  GcmFrameKey gcm;
+  std::string error;
+  if (!peek_frame_header(frame.data(), frame.size(), header, error) ||
+      !conn->accept_cipher(header, gcm, error)) {
+    std::cerr << "[server] decode error from " << conn->peer() << ": " << error << "\n";
+    conn->end_request();
+    return;
+  }
+  const auto received_at = std::chrono::steady_clock::now();
+  auto decode = [this, conn, header, gcm, received_at](const std::vector<std::uint8_t>& frame) {
+    Message msg;
+    FrameHeader decoded;
+    std::string error;
+    if (!decode_frame_envelope(frame, msg, decoded, error, &gcm)) {
+      std::cerr << "[server] decode error from " << conn->peer() << ": " << error << "\n";
+      // Later frames were numbered after this one; none of them can be trusted.
+      if (header.flags & kFrameFlagGcm) conn->abort();
+      conn->end_request();
+      return;
+    }
+    handle_message(conn, std::move(msg), header, received_at);
+  };
+  if (header.priority == Priority::Low) {
+    // Shed low-priority work rather than stall the reactor behind it. The
+    // frame is never decrypted, so the refusal carries no action; the client
+    // matches it to its request by the request_id in the reply header.
+    if (!decode_stage_.try_push([decode, frame = std::move(frame)] { decode(frame); })) {
+      respond(conn, make_error(Action{}, "SERVER_BUSY", "Server is busy, try again later"),
+              header);
     }
-    conn->start();
-    std::cout << "[server] new connection from " << conn->peer() << "\n";
+    return;
+  }
+  // Waiting here stalls this reactor, which in turn lets TCP push back on
+  // clients while the decode stage catches up.
+  if (!decode_stage_.push([decode, frame = std::move(frame)] { decode(frame); })) {
+    conn->end_request();
   }
 }
 
 void Server::handle_message(const std::shared_ptr<Connection>& conn,
-                            const Message& msg) {
+                            Message msg,
+                            const FrameHeader& header,
+                            std::chrono::steady_clock::time_point received_at) {
   std::cout << "[DEBUG] handle_message enqueuing task for action=" << msg.action << "\n";
-  workers_.enqueue([this, conn, msg] {
+  RequestContext ctx;
+  ctx.received_at = received_at;
+  ctx.kernel_tls = conn->kernel_tls();
+  ctx.connection = conn.get();
+  if (msg.deadline_ms > 0) {
+    ctx.deadline = ctx.received_at + std::chrono::milliseconds(msg.deadline_ms);
+  }
+  // Requests are queued per connection so one busy client cannot starve others.
+  const bool urgent = header.priority == Priority::High;
+  // The task owns the request from here on; keep what a refusal needs.
+  const Action action = msg.action;
+  const bool raw_data = !msg.raw_data.empty();
+  auto task = [this, conn, msg = std::move(msg), ctx, header]() mutable {
     std::cout << "[DEBUG] worker processing action=" << msg.action << "\n";
-    HandlerFn handler;
-    {
-      std::lock_guard<std::mutex> lock(handlers_mtx_);
-      auto it = handlers_.find(msg.action);
-      if (it != handlers_.end()) {
-        handler = it->second;
+    // A chunk cannot be dropped without breaking its stream.
+    const bool chunk = header.flags & kFrameFlagChunk;
+    if (!chunk && ctx.expired()) {
+      // The client has already given up; don't spend handler/DB time on it.
+      // Counted in the stats only: drops come in bursts under overload, where a
+      // log line per request would serialize the workers on stdout.
+      expired_dropped_.fetch_add(1);
+      if (!msg.raw_data.empty()) data_skipped_.fetch_add(1);
+      conn->end_request();
+      return;
+    }
+    ScopedRequestArena arena;
+    ctx.memory = arena.resource();
+    ScopedRequestContext scope(ctx);
+    if (chunk) {
+      consume_chunk(conn, std::move(msg), header);
+      return;
+    }
+    requests_by_action_[static_cast<std::size_t>(msg.action.id())].fetch_add(1);
+    static const Handler kNoHandler;
+    const auto entry = find_handler(msg.action);
+    const Handler& handler = entry ? *entry : kNoHandler;
+    if (!msg.raw_data.empty()) {
+      if ((handler.fn || handler.stream || handler.deferred) &&
+          handler.data == HandlerData::Parsed) {
+        std::string error;
+        if (!materialize_data(msg, error)) {
+          std::cerr << "[server] decode error from " << conn->peer() << ": " << error << "\n";
+          conn->end_request();
+          return;
+        }
+        data_parsed_.fetch_add(1);
+      } else {
+        data_skipped_.fetch_add(1);
       }
     }
 
     Message resp;
-    if (!handler) {
+    if (handler.stream) {
+      if (header.version != kProtocolV2) {
+        respond(conn, make_error(msg, "UNSUPPORTED_PROTOCOL", "Streaming needs protocol v2"),
+                header);
+        return;
+      }
+      ChunkWriter writer(conn, msg, header);
+      try {
+        resp = handler.stream(msg, writer);
+      } catch (const std::exception& ex) {
+        resp = make_error(msg, "HANDLER_ERROR", ex.what());
+      }
+      streams_sent_.fetch_add(1);
+      if (resp.action.empty()) resp.action = msg.action;
+      if (resp.session_id.empty()) resp.session_id = msg.session_id;
+      send_reply(conn, std::move(resp), writer.end_header());
+      return;
+    }
+    if (handler.deferred) {
+      RequestContext kept = ctx;
+      kept.memory = nullptr;  // the arena ends with this task
+      DeferredReply reply(this, conn, msg, header, kept);
+      try {
+        handler.deferred(msg, reply);
+      } catch (const std::exception& ex) {
+        reply(make_error(msg, "HANDLER_ERROR", ex.what()));
+      }
+      return;
+    }
+    if (!handler.fn) {
       std::cout << "[DEBUG] no handler found for " << msg.action << "\n";
-      resp = make_error(msg, "UNKNOWN_ACTION", "Action not supported");
+      resp = make_error(msg, handler.consumer ? "INVALID_REQUEST" : "UNKNOWN_ACTION",
+                        handler.consumer ? "Action expects a chunked stream"
+                                         : "Action not supported");
     } else {
       try {
         std::cout << "[DEBUG] calling handler for " << msg.action << "\n";
-        resp = handler(msg);
+        resp = handler.fn(msg);
         std::cout << "[DEBUG] handler returned, status=" << (int)resp.status << "\n";
       } catch (const std::exception& ex) {
         std::cout << "[DEBUG] handler threw exception: " << ex.what() << "\n";
         resp = make_error(msg, "HANDLER_ERROR", ex.what());
       }
     }
-    if (resp.type != MessageType::Response) {
-      resp.type = MessageType::Response;
-    }
     if (resp.action.empty()) resp.action = msg.action;
     if (resp.session_id.empty()) resp.session_id = msg.session_id;
-    resp.timestamp = static_cast<std::uint64_t>(
-        std::chrono::duration_cast<std::chrono::seconds>(
-            std::chrono::system_clock::now().time_since_epoch())
-            .count());
-    std::cout << "[DEBUG] sending response for " << msg.action << "\n";
-    conn->send(resp);
-    std::cout << "[DEBUG] response sent for " << msg.action << "\n";
-  });
+    respond(conn, std::move(resp), header);
+  };
+  const bool queued = workers_.enqueue(conn->peer(), urgent, std::move(task));
+  if (!queued) {
+    if (raw_data) data_skipped_.fetch_add(1);
+    respond(conn, make_error(action, "SERVER_BUSY", "Server is busy, try again later"), header);
+    return;
+  }
   std::cout << "[DEBUG] handle_message task enqueued\n";
 }
 
+void Server::consume_chunk(const std::shared_ptr<Connection>& conn, Message msg,
+                           const FrameHeader& header) {
+  // How far chunks may overtake each other across workers.
+  constexpr std::size_t kMaxEarlyChunks = 16;
+
+  auto stream = conn->inbound_stream(header.request_id);
+  if (!stream) {
+    respond(conn, make_error(msg, "STREAM_LIMIT", "Too many uploads in progress"), header);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(stream->mtx);
+  if (header.sequence != stream->next) {
+    if (header.sequence < stream->next || stream->early.size() >= kMaxEarlyChunks ||
+        stream->early.count(header.sequence) != 0) {
+      if (!stream->failed) {
+        stream->failed = true;
+        stream->consumer.reset();
+        respond(conn, make_error(msg, "INVALID_STREAM", "Chunk out of sequence"), header);
+      } else {
+        conn->end_request();
+      }
+      return;
+    }
+    stream->early.emplace(header.sequence, InboundStream::Chunk{std::move(msg), header});
+    return;
+  }
+  run_chunk(conn, *stream, std::move(msg), header);
+  for (auto it = stream->early.find(stream->next); it != stream->early.end() && !stream->done;
+       it = stream->early.find(stream->next)) {
+    auto next = std::move(it->second);
+    stream->early.erase(it);
+    run_chunk(conn, *stream, std::move(next.msg), next.header);
+  }
+  if (stream->done) {
+    // Anything numbered past the end of the stream is dropped.
+    for (std::size_t i = 0; i < stream->early.size(); ++i) conn->end_request();
+    stream->early.clear();
+  }
+}
+
+void Server::run_chunk(const std::shared_ptr<Connection>& conn, InboundStream& stream,
+                       Message msg, const FrameHeader& header) {
+  const bool last = header.flags & kFrameFlagEndOfStream;
+  ++stream.next;
+  if (last) {
+    stream.done = true;
+    conn->end_inbound_stream(header.request_id);
+  }
+  if (stream.failed) {
+    conn->end_request();
+    return;
+  }
+
+  std::optional<Message> resp;
+  if (header.sequence == 0) {
+    requests_by_action_[static_cast<std::size_t>(msg.action.id())].fetch_add(1);
+    const auto entry = find_handler(msg.action);
+    if (entry && entry->consumer) {
+      stream.consumer = entry->consumer();
+      streams_received_.fetch_add(1);
+    } else {
+      resp = make_error(msg, "UNKNOWN_ACTION", "Action does not accept streams");
+    }
+  }
+  if (!resp && !msg.raw_data.empty()) {
+    std::string error;
+    if (materialize_data(msg, error)) {
+      data_parsed_.fetch_add(1);
+    } else {
+      resp = make_error(msg, "INVALID_REQUEST", error);
+    }
+  }
+  if (!resp) {
+    try {
+      resp = stream.consumer->on_chunk(msg);
+      if (!resp && last) resp = stream.consumer->finish();
+    } catch (const std::exception& ex) {
+      resp = make_error(msg, "HANDLER_ERROR", ex.what());
+    }
+  }
+  if (!resp) {
+    conn->end_request();  // accepted; only the stream as a whole is answered
+    return;
+  }
+  stream.failed = !last;
+  stream.consumer.reset();
+  if (resp->action.empty()) resp->action = msg.action;
+  if (resp->session_id.empty()) resp->session_id = msg.session_id;
+  respond(conn, std::move(*resp), header);
+}
+
+void Server::respond(const std::shared_ptr<Connection>& conn, Message resp,
+                     const FrameHeader& header) {
+  send_reply(conn, std::move(resp), reply_header(header));
+}
+
+void Server::send_reply(const std::shared_ptr<Connection>& conn, Message resp,
+                        const FrameHeader& reply) {
+  resp.type = MessageType::Response;
+  resp.timestamp = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  bool queued = encode_stage_.push([conn, header = reply, resp = std::move(resp)] {
+    std::cout << "[DEBUG] sending response for " << resp.action << "\n";
+    conn->send(resp, header);
+    conn->end_request();
+    std::cout << "[DEBUG] response sent for " << resp.action << "\n";
+  });
+  if (!queued) conn->end_request();
+}
+
+void Server::remove_connection(const std::shared_ptr<Connection>& conn) {
+  std::lock_guard<std::mutex> lock(conns_mtx_);
+  connections_.erase(std::remove(connections_.begin(), connections_.end(), conn),
+                     connections_.end());
+  std::cout << "[server] connection closed " << conn->peer() << "\n";
+}
+
+nlohmann::json Server::stats() {
+  nlohmann::json shards = nlohmann::json::array();
+  for (auto& shard : shards_) {
+    nlohmann::json entry = {{"shard", shard->index()}, {"connections", shard->connection_count()}};
+    if (shard->cpu() >= 0) {
+      entry["cpu"] = shard->cpu();
+      entry["node"] = shard->node();
+    }
+    shards.push_back(std::move(entry));
+  }
+  nlohmann::json depths = nlohmann::json::object();
+  for (const auto& [client, depth] : workers_.queue_depths()) {
+    depths[client.empty() ? "-" : client] = depth;
+  }
+  std::size_t connections = 0;
+  {
+    std::lock_guard<std::mutex> lock(conns_mtx_);
+    connections = connections_.size();
+  }
+  nlohmann::json stages = nlohmann::json::array();
+  stages.push_back(decode_stage_.stats());
+  stages.push_back(workers_.stats());
+  stages.push_back(encode_stage_.stats());
+  if (handshake_stage_) stages.push_back(handshake_stage_->stats());
+  nlohmann::json actions = nlohmann::json::object();
+  for (std::size_t i = 0; i < kActionCount; ++i) {
+    const auto count = requests_by_action_[i].load();
+    if (count == 0) continue;
+    const auto name = to_string(static_cast<ActionId>(i));
+    actions[name.empty() ? "other" : std::string(name)] = count;
+  }
+  return {{"connections", connections},
+          {"shards", shards},
+          {"stages", stages},
+          {"queue",
+           {{"pending", workers_.pending()},
+            {"per_client", depths},
+            {"expired_dropped", expired_dropped_.load()}}},
+          {"actions", actions},
+          {"request_data", {{"parsed", data_parsed_.load()}, {"skipped", data_skipped_.load()}}},
+          {"streams", {{"sent", streams_sent_.load()}, {"received", streams_received_.load()}}},
+          {"tls",
+           {{"enabled", tls_ != nullptr},
+            {"accepted", tls_accepted_.load()},
+            {"failed", tls_failed_.load()}}}};
+}
+
 void Server::close_all_connections() {
   std::vector<std::shared_ptr<Connection>> to_close;
   {
@@ -197,66 +733,304 @@ void Server::close_all_connections() {
   }
 }
 
-Connection::Connection(int fd, Server* server, std::string peer)
-    : fd_(fd), server_(server), peer_(std::move(peer)) {}
+struct DeferredReply::State {
+  Server* server;
+  std::shared_ptr<Connection> conn;
+  Action action;
+  std::string session_id;
+  FrameHeader header;
+  RequestContext ctx;
+  std::atomic<bool> answered{false};
+
+  ~State() {
+    if (!answered.load()) {
+      server->respond(conn, make_error(action, "HANDLER_ERROR", "Request was not answered"),
+                      header);
+    }
+  }
+};
+
+DeferredReply::DeferredReply(Server* server, std::shared_ptr<Connection> conn,
+                             const Message& request, const FrameHeader& request_header,
+                             const RequestContext& ctx)
+    : state_(std::make_shared<State>()) {
+  state_->server = server;
+  state_->conn = std::move(conn);
+  state_->action = request.action;
+  state_->session_id = request.session_id;
+  state_->header = request_header;
+  state_->ctx = ctx;
+}
+
+void DeferredReply::operator()(Message resp) const {
+  if (state_->answered.exchange(true)) return;
+  if (resp.action.empty()) resp.action = state_->action;
+  if (resp.session_id.empty()) resp.session_id = state_->session_id;
+  state_->server->respond(state_->conn, std::move(resp), state_->header);
+}
+
+void DeferredReply::drop() const {
+  if (state_->answered.exchange(true)) return;
+  state_->server->expired_dropped_.fetch_add(1);
+  state_->conn->end_request();
+}
+
+const RequestContext& DeferredReply::context() const {
+  return state_->ctx;
+}
+
+ChunkWriter::ChunkWriter(std::shared_ptr<Connection> conn, const Message& request,
+                         const FrameHeader& request_header)
+    : conn_(std::move(conn)),
+      action_(request.action),
+      session_id_(request.session_id),
+      header_(reply_header(request_header)) {
+  header_.flags |= kFrameFlagChunk;
+}
+
+bool ChunkWriter::write(nlohmann::json data) {
+  // Output a stream may have queued before the producer waits, and how long
+  // it waits for a client that does not read.
+  constexpr std::size_t kMaxBacklogBytes = 1024 * 1024;
+  constexpr std::chrono::seconds kStallTimeout{30};
+
+  // The last sequence number is kept for the end of the stream.
+  if (!ok_ || next_ == std::numeric_limits<std::uint16_t>::max()) return false;
+  if (!conn_->wait_drained(kMaxBacklogBytes, kStallTimeout)) {
+    std::cerr << "[server] stream to " << conn_->peer() << " stalled, abandoning " << action_
+              << "\n";
+    ok_ = false;
+    return false;
+  }
+  Message chunk;
+  chunk.type = MessageType::Response;
+  chunk.action = action_;
+  chunk.session_id = session_id_;
+  chunk.timestamp = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  chunk.status = Status::Success;
+  chunk.data = std::move(data);
+  header_.sequence = next_;
+  ok_ = conn_->send(chunk, header_);
+  if (ok_) ++next_;
+  return ok_;
+}
+
+FrameHeader ChunkWriter::end_header() const {
+  FrameHeader end = header_;
+  end.flags |= kFrameFlagEndOfStream;
+  end.sequence = next_;
+  return end;
+}
+
+Connection::Connection(int fd, Server* server, std::string peer, bool kernel_tls)
+    : fd_(fd), server_(server), peer_(std::move(peer)), kernel_tls_(kernel_tls) {}
 
 Connection::~Connection() {
   stop();
 }
 
-void Connection::start() {
-  std::cout << "[DEBUG] Connection::start() for " << peer_ << "\n";
-  reader_ = std::thread(&Connection::read_loop, this);
-  std::cout << "[DEBUG] reader thread created\n";
+void Connection::stop() {
+  close_fd();
 }
 
-void Connection::stop() {
-  if (!alive_.exchange(false)) return;
+bool Connection::close_fd() {
+  if (!alive_.exchange(false)) return false;
+  std::lock_guard<std::mutex> lock(send_mtx_);  // no write may race the close
   if (fd_ >= 0) {
     ::shutdown(fd_, SHUT_RDWR);
     ::close(fd_);
     fd_ = -1;
   }
-  if (reader_.joinable()) reader_.join();
+  drained_cv_.notify_all();
+  return true;
 }
 
-void Connection::send(const Message& msg) {
+bool Connection::send(const Message& msg, const FrameHeader& header) {
+  // A client that stops reading must not hold an unbounded backlog.
+  constexpr std::size_t kMaxOutboundBytes = 8 * 1024 * 1024;
+  // Encode buffers are kept per thread; one oversized reply should not pin
+  // its memory for the life of the thread.
+  constexpr std::size_t kMaxRetainedFrameBytes = 256 * 1024;
+
   std::string error;
-  auto frame = encode_frame(msg, error);
-  if (frame.empty()) {
+  thread_local std::vector<std::uint8_t> frame;
+  if (frame.capacity() > kMaxRetainedFrameBytes) std::vector<std::uint8_t>().swap(frame);
+  std::unique_lock<std::mutex> seal;
+  GcmFrameKey gcm;
+  if (header.flags & kFrameFlagGcm) {
+    if (!gcm_ready_.load(std::memory_order_acquire)) {
+      std::cerr << "[server] encode error to " << peer_ << ": no GCM keys\n";
+      return false;
+    }
+    seal = std::unique_lock<std::mutex>(seal_mtx_);
+    gcm = {gcm_keys_.send, send_sequence_ + 1};
+  }
+  if (!encode_frame_into(msg, header, frame, error, &gcm)) {
     std::cerr << "[server] encode error to " << peer_ << ": " << error << "\n";
-    return;
+    return false;
   }
+  if (seal) send_sequence_ = gcm.sequence;
+  bool watch = false;
+  {
+    std::lock_guard<std::mutex> lock(send_mtx_);
+    if (!alive_.load()) return false;
+    if (outbuf_.size() + frame.size() > kMaxOutboundBytes) {
+      std::cerr << "[server] send error to " << peer_ << ": client is not reading\n";
+      outbuf_.clear();
+      write_pending_.store(false);
+      ::shutdown(fd_, SHUT_RDWR);  // the shard sees EOF and closes
+      return false;
+    }
+    const bool was_pending = !outbuf_.empty();
+    outbuf_.insert(outbuf_.end(), frame.begin(), frame.end());
+    if (!was_pending) {
+      write_buffered();
+      watch = !outbuf_.empty();
+    }
+  }
+  if (watch) {
+    if (auto* shard = shard_.load()) shard->watch_writable(shared_from_this());
+  }
+  return true;
+}
+
+bool Connection::wait_drained(std::size_t limit, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(send_mtx_);
+  drained_cv_.wait_for(lock, timeout,
+                       [&] { return !alive_.load() || outbuf_.size() <= limit; });
+  return alive_.load() && outbuf_.size() <= limit;
+}
+
+void Connection::flush() {
   std::lock_guard<std::mutex> lock(send_mtx_);
-  if (!write_frame(fd_, frame, error)) {
-    std::cerr << "[server] send error to " << peer_ << ": " << error << "\n";
+  if (alive_.load()) write_buffered();
+}
+
+void Connection::write_buffered() {
+  std::size_t written = 0;
+  while (written < outbuf_.size()) {
+    ssize_t n = ::send(fd_, outbuf_.data() + written, outbuf_.size() - written,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      written += static_cast<std::size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    std::cerr << "[server] send error to " << peer_ << ": " << std::strerror(errno) << "\n";
+    outbuf_.clear();
+    write_pending_.store(false);
+    ::shutdown(fd_, SHUT_RDWR);
+    drained_cv_.notify_all();
+    return;
   }
+  outbuf_.erase(outbuf_.begin(), outbuf_.begin() + static_cast<std::ptrdiff_t>(written));
+  write_pending_.store(!outbuf_.empty());
+  if (written > 0) drained_cv_.notify_all();
 }
 
-void Connection::read_loop() {
-  std::cout << "[DEBUG] read_loop started for " << peer_ << "\n";
-  while (alive_.load()) {
-    std::vector<std::uint8_t> frame;
-    std::string error;
-    std::cout << "[DEBUG] waiting for frame from " << peer_ << "\n";
-    if (!read_frame(fd_, frame, error)) {
-      if (alive_.load()) {
-        std::cerr << "[server] read error from " << peer_ << ": " << error << "\n";
-      }
-      break;
+void Connection::end_request() {
+  if (inflight_.fetch_sub(1) == 1 && closing_.load()) {
+    close_when_done();
+  }
+}
+
+void Connection::close_when_done() {
+  closing_.store(true);
+  if (inflight_.load() > 0 || write_pending_.load()) return;
+  if (auto* shard = shard_.load()) {
+    shard->retire(shared_from_this());
+  } else if (close_fd()) {
+    server_->remove_connection(shared_from_this());
+  }
+}
+
+std::shared_ptr<InboundStream> Connection::inbound_stream(std::uint32_t id) {
+  constexpr std::size_t kMaxInboundStreams = 4;
+  std::lock_guard<std::mutex> lock(streams_mtx_);
+  auto it = inbound_.find(id);
+  if (it != inbound_.end()) return it->second;
+  if (inbound_.size() >= kMaxInboundStreams) return nullptr;
+  return inbound_.emplace(id, std::make_shared<InboundStream>()).first->second;
+}
+
+void Connection::end_inbound_stream(std::uint32_t id) {
+  std::lock_guard<std::mutex> lock(streams_mtx_);
+  inbound_.erase(id);
+}
+
+bool Connection::accept_cipher(const FrameHeader& header, GcmFrameKey& gcm,
+                               std::string& error) {
+  if (header.flags & kFrameFlagPlaintext) {
+    if (kernel_tls_) return true;
+    error = "plaintext frame outside kernel TLS";
+    return false;
+  }
+  if (header.flags & kFrameFlagGcm) {
+    if (!gcm_ready_.load(std::memory_order_acquire)) {
+      error = "GCM frame before key agreement";
+      return false;
     }
-    std::cout << "[DEBUG] got frame, decoding...\n";
-    Message msg;
-    if (!decode_frame(frame, msg, error)) {
-      std::cerr << "[server] decode error from " << peer_ << ": " << error << "\n";
-      continue;
+    authenticated_ = true;
+    gcm = {gcm_keys_.recv, ++recv_sequence_};
+  } else if (authenticated_) {
+    error = "unauthenticated frame on a GCM connection";
+    return false;
+  }
+  return true;
+}
+
+bool Connection::set_gcm_keys(const GcmKeys& keys) {
+  if (gcm_claimed_.exchange(true)) return false;
+  gcm_keys_ = keys;
+  gcm_ready_.store(true, std::memory_order_release);
+  return true;
+}
+
+void Connection::abort() {
+  std::lock_guard<std::mutex> lock(send_mtx_);
+  if (alive_.load() && fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
+}
+
+bool Connection::on_readable(std::uint64_t& frames) {
+  constexpr std::size_t kReadChunk = 64 * 1024;
+  std::size_t old_size = inbuf_.size();
+  inbuf_.resize(old_size + kReadChunk);
+  ssize_t n = ::recv(fd_, inbuf_.data() + old_size, kReadChunk, MSG_DONTWAIT);
+  if (n <= 0) {
+    inbuf_.resize(old_size);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return true;
+    if (n < 0 && alive_.load()) {
+      std::cerr << "[server] read error from " << peer_ << ": " << std::strerror(errno) << "\n";
     }
-    std::cout << "[DEBUG] decoded msg action=" << msg.action << ", calling handler...\n";
-    server_->handle_message(shared_from_this(), msg);
-    std::cout << "[DEBUG] handler returned\n";
+    return false;
   }
-  std::cout << "[DEBUG] read_loop exiting for " << peer_ << "\n";
-  alive_.store(false);
+  inbuf_.resize(old_size + static_cast<std::size_t>(n));
+
+  std::size_t offset = 0;
+  while (inbuf_.size() - offset >= kFramePrefixBytes) {
+    std::uint32_t be_len = 0;
+    std::memcpy(&be_len, inbuf_.data() + offset, sizeof(be_len));
+    const std::uint32_t payload_len = ntohl(be_len);
+    if (payload_len > kMaxPayloadSize) {
+      std::cerr << "[server] read error from " << peer_ << ": payload too large\n";
+      return false;
+    }
+    const std::size_t frame_len = kFramePrefixBytes + payload_len;
+    if (inbuf_.size() - offset < frame_len) break;
+
+    std::vector<std::uint8_t> frame(inbuf_.begin() + offset, inbuf_.begin() + offset + frame_len);
+    offset += frame_len;
+    ++frames;
+
+    begin_request();
+    server_->submit_frame(shared_from_this(), std::move(frame));
+  }
+  inbuf_.erase(inbuf_.begin(), inbuf_.begin() + offset);
+  return true;
 }
 
 }  // namespace quiz::server
@@ -0,0 +1,119 @@
+#include "server/stage.hpp"
+
+namespace quiz::server {
+
+namespace {
+
+void update_max(std::atomic<std::uint64_t>& slot, std::uint64_t value) {
+  std::uint64_t cur = slot.load();
+  while (value > cur && !slot.compare_exchange_weak(cur, value)) {
+  }
+}
+
+double avg_us(std::uint64_t total_ns, std::uint64_t count) {
+  return count == 0 ? 0.0 : static_cast<double>(total_ns) / 1000.0 / static_cast<double>(count);
+}
+
+}  // namespace
+
+void StageMetrics::record(std::uint64_t queue_ns, std::uint64_t service_ns) {
+  processed_.fetch_add(1);
+  queue_ns_.fetch_add(queue_ns);
+  service_ns_.fetch_add(service_ns);
+  update_max(max_queue_ns_, queue_ns);
+  update_max(max_service_ns_, service_ns);
+}
+
+nlohmann::json StageMetrics::snapshot() const {
+  const std::uint64_t processed = processed_.load();
+  return {{"processed", processed},
+          {"rejected", rejected_.load()},
+          {"avg_queue_us", avg_us(queue_ns_.load(), processed)},
+          {"avg_service_us", avg_us(service_ns_.load(), processed)},
+          {"max_queue_us", max_queue_ns_.load() / 1000},
+          {"max_service_us", max_service_ns_.load() / 1000}};
+}
+
+Stage::Stage(std::string name, std::size_t threads, std::size_t capacity)
+    : name_(std::move(name)), capacity_(capacity == 0 ? 1 : capacity) {
+  if (threads == 0) threads = 1;
+  threads_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back(&Stage::worker_loop, this);
+  }
+}
+
+Stage::~Stage() {
+  shutdown();
+}
+
+bool Stage::push(std::function<void()> task) {
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    not_full_.wait(lock, [this] { return stopping_ || queue_.size() < capacity_; });
+    if (stopping_) return false;
+    queue_.push_back({std::move(task), std::chrono::steady_clock::now()});
+  }
+  not_empty_.notify_one();
+  return true;
+}
+
+bool Stage::try_push(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) return false;
+    if (queue_.size() >= capacity_) {
+      metrics_.reject();
+      return false;
+    }
+    queue_.push_back({std::move(task), std::chrono::steady_clock::now()});
+  }
+  not_empty_.notify_one();
+  return true;
+}
+
+void Stage::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stopping_) return;
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+  for (auto& t : threads_) {
+    if (t.joinable()) t.join();
+  }
+}
+
+nlohmann::json Stage::stats() {
+  nlohmann::json out = metrics_.snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  out["stage"] = name_;
+  out["threads"] = threads_.size();
+  out["capacity"] = capacity_;
+  out["depth"] = queue_.size();
+  return out;
+}
+
+void Stage::worker_loop() {
+  while (true) {
+    Item item;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      not_empty_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // stopping and drained
+      item = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    not_full_.notify_one();
+
+    auto t0 = std::chrono::steady_clock::now();
+    item.task();
+    auto t1 = std::chrono::steady_clock::now();
+    metrics_.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t0 - item.enqueued_at).count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+  }
+}
+
+}  // namespace quiz::server
@@ -1,12 +1,66 @@
 #include "server/thread_pool.hpp"
 
+#include "server/affinity.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <iostream>
+#include <sstream>
+
 namespace quiz::server {
 
-ThreadPool::ThreadPool(std::size_t workers) {
-  if (workers == 0) workers = 1;
-  threads_.reserve(workers);
-  for (std::size_t i = 0; i < workers; ++i) {
-    threads_.emplace_back(&ThreadPool::worker_loop, this);
+namespace {
+
+// Weight of the newest sample in the per-client service time average.
+constexpr std::int64_t kCostSmoothing = 4;
+// Consecutive quiet windows before a worker is retired.
+constexpr int kShrinkAfterWindows = 4;
+// How long a client's account outlives its last request.
+constexpr std::chrono::seconds kFlowGrace{10};
+
+std::int64_t thread_cpu_ns() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+ThreadPoolOptions fixed_size(std::size_t workers, std::size_t capacity,
+                             std::chrono::microseconds quantum) {
+  ThreadPoolOptions options;
+  options.min_workers = workers;
+  options.max_workers = workers;
+  options.capacity = capacity;
+  options.quantum = quantum;
+  return options;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t workers, std::size_t capacity,
+                       std::chrono::microseconds quantum)
+    : ThreadPool(fixed_size(workers, capacity, quantum)) {}
+
+ThreadPool::ThreadPool(const ThreadPoolOptions& options)
+    : capacity_(options.capacity),
+      quantum_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(options.quantum).count()),
+      default_cost_ns_(quantum_ns_ / 4),
+      cpus_(options.cpus),
+      min_workers_(std::max<std::size_t>(1, options.min_workers)),
+      max_workers_(std::max(min_workers_, options.max_workers)),
+      resize_interval_(options.resize_interval),
+      target_wait_ns_(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(options.target_queue_wait).count()) {
+  if (quantum_ns_ <= 0) quantum_ns_ = 1;
+  if (resize_interval_.count() <= 0) resize_interval_ = std::chrono::milliseconds(500);
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (std::size_t i = 0; i < min_workers_; ++i) spawn_worker();
+  }
+  if (max_workers_ > min_workers_) {
+    sizer_ = std::thread(&ThreadPool::sizer_loop, this);
   }
 }
 
@@ -14,13 +68,38 @@ ThreadPool::~ThreadPool() {
   shutdown();
 }
 
-void ThreadPool::enqueue(std::function<void()> task) {
+bool ThreadPool::enqueue(std::function<void()> task) {
+  return enqueue(std::string(), std::move(task));
+}
+
+bool ThreadPool::enqueue(const std::string& client, std::function<void()> task) {
+  return enqueue(client, false, std::move(task));
+}
+
+bool ThreadPool::enqueue(const std::string& client, bool urgent, std::function<void()> task) {
   {
     std::lock_guard<std::mutex> lock(mtx_);
-    if (stopping_) return;
-    tasks_.push(std::move(task));
+    if (stopping_) return false;
+    if (capacity_ > 0 && pending_ >= capacity_) {
+      metrics_.reject();
+      return false;
+    }
+    auto [it, inserted] = flows_.try_emplace(client);
+    Flow& flow = it->second;
+    if (inserted) flow.est_cost_ns = default_cost_ns_;
+    if (flow.tasks.empty()) active_.push_back(client);
+    Item item{std::move(task), std::chrono::steady_clock::now(), urgent};
+    if (urgent) {
+      auto pos = std::find_if(flow.tasks.begin(), flow.tasks.end(),
+                              [](const Item& queued) { return !queued.urgent; });
+      flow.tasks.insert(pos, std::move(item));
+    } else {
+      flow.tasks.push_back(std::move(item));
+    }
+    ++pending_;
   }
   cv_.notify_one();
+  return true;
 }
 
 void ThreadPool::shutdown() {
@@ -30,22 +109,240 @@ void ThreadPool::shutdown() {
     stopping_ = true;
   }
   cv_.notify_all();
-  for (auto& t : threads_) {
+  sizer_cv_.notify_all();
+  if (sizer_.joinable()) sizer_.join();
+  std::unordered_map<std::thread::id, std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    threads.swap(threads_);
+  }
+  for (auto& [id, t] : threads) {
     if (t.joinable()) t.join();
   }
 }
 
-void ThreadPool::worker_loop() {
+void ThreadPool::spawn_worker() {
+  const int cpu = cpus_.empty() ? -1 : cpus_[spawned_ % cpus_.size()];
+  ++spawned_;
+  std::thread t(&ThreadPool::worker_loop, this, cpu);
+  auto id = t.get_id();
+  threads_.emplace(id, std::move(t));
+  ++live_workers_;
+}
+
+void ThreadPool::join_exited(std::unique_lock<std::mutex>& lock) {
+  std::vector<std::thread> done;
+  for (auto id : exited_) {
+    auto it = threads_.find(id);
+    if (it == threads_.end()) continue;
+    done.push_back(std::move(it->second));
+    threads_.erase(it);
+  }
+  exited_.clear();
+  lock.unlock();
+  for (auto& t : done) t.join();
+  lock.lock();
+}
+
+void ThreadPool::sizer_loop() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (!stopping_) {
+    sizer_cv_.wait_for(lock, resize_interval_, [this] { return stopping_; });
+    if (stopping_) break;
+    resize_once(lock);
+    join_exited(lock);
+  }
+}
+
+void ThreadPool::resize_once(std::unique_lock<std::mutex>& lock) {
+  const auto now = std::chrono::steady_clock::now();
+  const std::size_t workers = live_workers_;
+
+  // Average wait of tasks started this window; if nothing started, the age of
+  // the oldest queued task still shows a stall.
+  std::int64_t wait_ns = window_tasks_ > 0
+                             ? window_wait_ns_ / static_cast<std::int64_t>(window_tasks_)
+                             : 0;
+  for (const auto& [client, flow] : flows_) {
+    if (flow.tasks.empty()) continue;
+    wait_ns = std::max<std::int64_t>(
+        wait_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     now - flow.tasks.front().enqueued_at)
+                     .count());
+  }
+  const double capacity_ns = static_cast<double>(workers) * resize_interval_.count();
+  const double busy = capacity_ns > 0 ? window_busy_ns_ / capacity_ns : 0.0;
+  const double blocked =
+      window_busy_ns_ > 0 ? static_cast<double>(window_blocked_ns_) / window_busy_ns_ : 0.0;
+  window_wait_ns_ = window_busy_ns_ = window_blocked_ns_ = 0;
+  window_tasks_ = 0;
+
+  const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t target = workers;
+  if (wait_ns > target_wait_ns_ && busy > 0.75 && workers < max_workers_ &&
+      (blocked >= 0.5 || workers < cores)) {
+    target = std::min(max_workers_, workers + std::max<std::size_t>(1, workers / 4));
+    idle_windows_ = 0;
+  } else if (wait_ns < target_wait_ns_ / 4 && busy < 0.25 && workers > min_workers_) {
+    if (++idle_windows_ >= kShrinkAfterWindows) {
+      target = workers - 1;
+      idle_windows_ = 0;
+    }
+  } else {
+    idle_windows_ = 0;
+  }
+  if (target == workers) return;
+
+  if (target > workers) {
+    for (std::size_t i = workers; i < target; ++i) spawn_worker();
+  } else {
+    retire_ += workers - target;
+    cv_.notify_all();
+  }
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1) << "[server] worker pool: "
+      << (target > workers ? "grow " : "shrink ") << workers << " -> " << target
+      << " (queue wait " << wait_ns / 1e6 << " ms, busy " << busy * 100 << "%, blocked "
+      << blocked * 100 << "%)\n";
+  lock.unlock();
+  std::cout << oss.str();
+  lock.lock();
+}
+
+std::map<std::string, std::size_t> ThreadPool::queue_depths() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  std::map<std::string, std::size_t> depths;
+  for (const auto& [client, flow] : flows_) {
+    if (!flow.tasks.empty()) depths[client] = flow.tasks.size();
+  }
+  return depths;
+}
+
+std::size_t ThreadPool::pending() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return pending_;
+}
+
+nlohmann::json ThreadPool::stats() {
+  nlohmann::json out = metrics_.snapshot();
+  std::lock_guard<std::mutex> lock(mtx_);
+  out["stage"] = "dispatch";
+  out["threads"] = live_workers_;
+  out["min_threads"] = min_workers_;
+  out["max_threads"] = max_workers_;
+  out["capacity"] = capacity_;
+  out["depth"] = pending_;
+  if (!cpus_.empty()) out["cpus"] = cpus_;
+  return out;
+}
+
+bool ThreadPool::next_task(std::unique_lock<std::mutex>& lock, std::string& client,
+                           Item& item, std::int64_t& charged_ns) {
+  cv_.wait(lock, [this] { return stopping_ || retire_ > 0 || !active_.empty(); });
+  if (retire_ > 0 && !stopping_) {
+    --retire_;
+    return false;
+  }
+  if (active_.empty()) return false;  // stopping and drained
+
+  // Each visit tops a client up by one quantum; a client keeps the head of
+  // the round while it still has credit, then moves to the back. Rather than
+  // spinning through the rounds a client deep in debt needs, find the first
+  // client to reach credit and apply those rounds at once.
+  if (flows_[active_.front()].deficit_ns <= 0) {
+    std::size_t first = 0;
+    std::int64_t rounds = std::numeric_limits<std::int64_t>::max();
+    for (std::size_t i = 0; i < active_.size() && rounds > 0; ++i) {
+      const std::int64_t deficit = flows_[active_[i]].deficit_ns;
+      const std::int64_t needed = deficit > 0 ? 0 : -deficit / quantum_ns_ + 1;
+      if (needed < rounds) {
+        rounds = needed;
+        first = i;
+      }
+    }
+    // Clients ahead of it were visited once more in the final round.
+    for (std::size_t i = 0; i < active_.size(); ++i) {
+      flows_[active_[i]].deficit_ns += (rounds + (i < first ? 1 : 0)) * quantum_ns_;
+    }
+    std::rotate(active_.begin(), active_.begin() + static_cast<std::ptrdiff_t>(first),
+                active_.end());
+  }
+
+  client = active_.front();
+  Flow& flow = flows_[client];
+  item = std::move(flow.tasks.front());
+  flow.tasks.pop_front();
+  --pending_;
+  window_wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - item.enqueued_at)
+                         .count();
+  ++window_tasks_;
+
+  // Charge the expected cost now so concurrent workers see it; the real
+  // service time is settled when the task finishes.
+  charged_ns = flow.est_cost_ns;
+  flow.deficit_ns -= charged_ns;
+  ++flow.running;
+  if (flow.tasks.empty()) {
+    // Leaves the round; unused credit is forfeited, debt is kept.
+    active_.pop_front();
+    flow.deficit_ns = std::min<std::int64_t>(flow.deficit_ns, 0);
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (now - last_prune_ >= kFlowGrace) prune_flows(now);
+  return true;
+}
+
+void ThreadPool::prune_flows(std::chrono::steady_clock::time_point now) {
+  last_prune_ = now;
+  for (auto it = flows_.begin(); it != flows_.end();) {
+    const Flow& flow = it->second;
+    const bool idle = flow.tasks.empty() && flow.running == 0;
+    it = idle && now - flow.idle_since >= kFlowGrace ? flows_.erase(it) : std::next(it);
+  }
+}
+
+void ThreadPool::worker_loop(int cpu) {
+  if (cpu >= 0) {
+    std::string error;
+    if (!pin_current_thread(cpu, &error)) std::cerr << "[server] worker: " << error << "\n";
+  }
   while (true) {
-    std::function<void()> task;
+    std::string client;
+    Item item;
+    std::int64_t charged_ns = 0;
     {
       std::unique_lock<std::mutex> lock(mtx_);
-      cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) return;
-      task = std::move(tasks_.front());
-      tasks_.pop();
+      if (!next_task(lock, client, item, charged_ns)) {
+        --live_workers_;
+        exited_.push_back(std::this_thread::get_id());
+        return;
+      }
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    const std::int64_t cpu0 = thread_cpu_ns();
+    item.task();
+    std::int64_t spent_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - t0)
+                                .count();
+    const std::int64_t cpu_ns = thread_cpu_ns() - cpu0;
+    metrics_.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t0 - item.enqueued_at).count(),
+        spent_ns);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    window_busy_ns_ += spent_ns;
+    window_blocked_ns_ += std::max<std::int64_t>(0, spent_ns - cpu_ns);
+    // Clients are charged CPU time, not wall time: a request waiting on
+    // SQLite or a lock holds a worker but leaves the cores to others, and
+    // the pool adds workers for blocked time rather than rationing it.
+    Flow& flow = flows_[client];  // kept while it has tasks running
+    flow.deficit_ns -= cpu_ns - charged_ns;
+    flow.est_cost_ns += (cpu_ns - flow.est_cost_ns) / kCostSmoothing;
+    if (--flow.running == 0 && flow.tasks.empty()) {
+      flow.idle_since = std::chrono::steady_clock::now();
     }
-    task();
   }
 }
 
@@ -0,0 +1,221 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include <unistd.h>
+
+#include "server/auth.hpp"
+
+using quiz::server::AuthService;
+using quiz::server::SessionInfo;
+using quiz::server::SessionSigner;
+
+namespace {
+
+struct TestRunner {
+  int failures{0};
+
+  void expect(bool condition, const std::string& msg) {
+    if (!condition) {
+      ++failures;
+      std::cerr << "[FAIL] " << msg << "\n";
+    }
+  }
+
+  int exit_code() const {
+    if (failures == 0) {
+      std::cout << "[PASS] all auth tests\n";
+      return 0;
+    }
+    std::cerr << "[FAILURES] total: " << failures << "\n";
+    return 1;
+  }
+};
+
+std::uint64_t now_seconds() {
+  using namespace std::chrono;
+  return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+}
+
+std::vector<std::string> split(const std::string& token) {
+  std::vector<std::string> fields;
+  std::istringstream in(token);
+  std::string field;
+  while (std::getline(in, field, '.')) fields.push_back(field);
+  return fields;
+}
+
+// `token` with field `index` (0 is "st1") replaced and the MAC kept.
+std::string with_field(const std::string& token, std::size_t index, const std::string& value) {
+  auto fields = split(token);
+  fields[index] = value;
+  std::string out = fields[0];
+  for (std::size_t i = 1; i < fields.size(); ++i) out += '.' + fields[i];
+  return out;
+}
+
+SessionInfo session(std::uint64_t expires_at) {
+  return SessionInfo{7, "alice", "STUDENT", {}, expires_at};
+}
+
+// Rejected, and for the given reason.
+bool rejected(SessionSigner& signer, const std::string& token, const std::string& reason) {
+  std::string error;
+  return !signer.verify(token, &error) && error == reason;
+}
+
+}  // namespace
+
+int main() {
+  TestRunner tr;
+  const std::uint64_t later = now_seconds() + 3600;
+
+  // A token verifies back to the claims it was issued for.
+  {
+    SessionSigner signer(std::chrono::hours(1));
+    const std::string token = signer.issue(session(later));
+    tr.expect(SessionSigner::is_signed(token) && split(token).size() == 7, "token has 7 fields");
+    std::string error;
+    auto got = signer.verify(token, &error);
+    tr.expect(got && got->user_id == 7 && got->username == "alice" && got->role == "STUDENT" &&
+                  got->expires_at == later && got->token == token,
+              "round trip keeps the claims");
+    tr.expect(!SessionSigner::is_signed("0123abcd"), "random tokens are not signed");
+
+    SessionInfo odd{42, "b\xC3\xB8.b", "ADMIN", {}, later};
+    got = signer.verify(signer.issue(odd), &error);
+    tr.expect(got && got->username == odd.username && got->role == "ADMIN",
+              "username with a dot and UTF-8 round trips");
+  }
+
+  // Changing any claim, or the MAC, breaks the MAC; a token only verifies
+  // under the key id that signed it.
+  {
+    SessionSigner signer(std::chrono::hours(1));
+    const std::string token = signer.issue(session(later));
+    const std::string reason = "Session not found";
+    tr.expect(rejected(signer, with_field(token, 2, "8"), reason), "tampered user_id rejected");
+    tr.expect(rejected(signer, with_field(token, 3, std::to_string(later + 1)), reason),
+              "tampered expiry rejected");
+    tr.expect(rejected(signer, with_field(token, 4, "ADMIN"), reason), "tampered role rejected");
+    tr.expect(rejected(signer, with_field(token, 5, "626f62"), reason),
+              "tampered username rejected");
+    std::string mac = split(token)[6];
+    mac[0] = mac[0] == '0' ? '1' : '0';
+    tr.expect(rejected(signer, with_field(token, 6, mac), reason), "tampered MAC rejected");
+    tr.expect(rejected(signer, with_field(token, 1, "99"), reason), "unknown key id rejected");
+
+    SessionSigner other(std::chrono::hours(1));
+    tr.expect(rejected(other, token, reason), "another signer's token rejected");
+    const std::string own = other.issue(session(later));
+    tr.expect(rejected(signer, own, reason), "same key id, different key rejected");
+  }
+
+  // A genuine token past its expiry is refused as expired.
+  {
+    SessionSigner signer(std::chrono::hours(1));
+    const std::string token = signer.issue(session(now_seconds() - 10));
+    tr.expect(rejected(signer, token, "Session expired"), "expired token rejected");
+  }
+
+  // Anything that does not parse is refused before a MAC is computed.
+  {
+    SessionSigner signer(std::chrono::hours(1));
+    const std::string token = signer.issue(session(later));
+    const std::string reason = "Malformed session token";
+    const auto fields = split(token);
+    tr.expect(rejected(signer, "st1.1.7." + fields[3], reason), "missing fields rejected");
+    tr.expect(rejected(signer, "st1.", reason), "prefix alone rejected");
+    tr.expect(rejected(signer, token + ".00", reason), "extra field rejected");
+    tr.expect(rejected(signer, with_field(token, 4, "STU.DENT"), reason),
+              "dot in a field rejected");
+    tr.expect(rejected(signer, with_field(token, 5, "zz"), reason), "non-hex username rejected");
+    tr.expect(rejected(signer, with_field(token, 5, "616"), reason), "odd-length hex rejected");
+    tr.expect(rejected(signer, with_field(token, 5, "616C"), reason), "upper-case hex rejected");
+    tr.expect(rejected(signer, with_field(token, 4, ""), reason), "empty role rejected");
+    tr.expect(rejected(signer, with_field(token, 2, ""), reason), "empty user_id rejected");
+    tr.expect(rejected(signer, with_field(token, 2, "-7"), reason), "negative user_id rejected");
+    tr.expect(rejected(signer, with_field(token, 2, "2147483648"), reason),
+              "user_id past INT32_MAX rejected");
+    tr.expect(rejected(signer, with_field(token, 1, "4294967297"), reason),
+              "key id past UINT32_MAX rejected");
+    tr.expect(rejected(signer, with_field(token, 3, "18446744073709551616"), reason),
+              "expiry past UINT64_MAX rejected");
+    tr.expect(rejected(signer, with_field(token, 3, "99999999999999999999999"), reason),
+              "overlong expiry rejected");
+    tr.expect(rejected(signer, "", reason), "empty token rejected");
+    tr.expect(signer.stats()["rejected"] == 15 && signer.stats()["verified"] == 0,
+              "rejections are counted");
+  }
+
+  // After a rotation, tokens of the previous key verify while it is kept;
+  // a key goes once everything it signed has expired.
+  {
+    SessionSigner signer(std::chrono::seconds(0));  // a new key for every token
+    const std::string first = signer.issue(session(later));
+    const std::string second = signer.issue(session(later));
+    tr.expect(split(first)[1] == "1" && split(second)[1] == "2", "rotation issues a new key id");
+    tr.expect(signer.verify(first) && signer.verify(second), "retained key still verifies");
+    tr.expect(signer.stats()["keys"] == 2, "both keys kept");
+
+    SessionSigner pruned(std::chrono::seconds(0));
+    const std::string stale = pruned.issue(session(now_seconds() - 10));
+    pruned.issue(session(later));
+    tr.expect(pruned.stats()["keys"] == 1, "key with only expired tokens dropped");
+    tr.expect(rejected(pruned, stale, "Session not found"), "token of a dropped key rejected");
+
+    SessionSigner steady(std::chrono::hours(1));
+    tr.expect(split(steady.issue(session(later)))[1] == split(steady.issue(session(later)))[1],
+              "no rotation before the period");
+  }
+
+  // LOGOUT revokes one signed token: it no longer validates, other sessions
+  // of the user still do, and tokens that do not verify are never stored.
+  {
+    const auto db_path = std::filesystem::temp_directory_path() /
+                         ("quiz_auth_tests_" + std::to_string(::getpid()) + ".db");
+    std::filesystem::remove(db_path);
+    std::ifstream schema_file(QUIZ_SCHEMA_PATH);
+    std::stringstream schema;
+    schema << schema_file.rdbuf();
+    sqlite3* db = nullptr;
+    const bool created = sqlite3_open(db_path.c_str(), &db) == SQLITE_OK &&
+                         sqlite3_exec(db, schema.str().c_str(), nullptr, nullptr, nullptr) ==
+                             SQLITE_OK;
+    sqlite3_close(db);
+    tr.expect(created, "test database created");
+    {
+      AuthService auth(db_path.string(), 1, 4);
+      auth.enable_signed_tokens(std::chrono::hours(1));
+      std::string error;
+      tr.expect(auth.register_user("alice", "s3cret", "Alice", "a@example.com", "STUDENT", &error)
+                    .has_value(),
+                "register user: " + error);
+      // Tokens are deterministic, so another session needs other claims:
+      // two logins in the same second with one TTL get the same token.
+      auto login = auth.login("alice", "s3cret", 3600, &error);
+      auto other = auth.login("alice", "s3cret", 7200, &error);
+      tr.expect(login && other && SessionSigner::is_signed(login->token),
+                "login issues a signed token");
+      if (login && other) {
+        tr.expect(auth.validate(login->token).has_value(), "token validates before logout");
+        tr.expect(auth.logout(login->token, &error), "logout succeeds");
+        auto after = auth.validate(login->token, &error);
+        tr.expect(!after && error == "Session not found", "logged-out token rejected");
+        tr.expect(auth.validate(other->token).has_value(), "other session still valid");
+
+        auth.logout(with_field(other->token, 2, "8"));
+        tr.expect(auth.stats()["signed_tokens"]["revoked"] == 1, "forged logout not stored");
+        tr.expect(auth.validate(other->token).has_value(), "forged logout revokes nothing");
+      }
+    }
+    std::filesystem::remove(db_path);
+  }
+
+  return tr.exit_code();
+}
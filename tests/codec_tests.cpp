@@ -2,8 +2,16 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
 
+#include "common/aes_crypto.hpp"
 #include "common/codec.hpp"
+#include "common/compress.hpp"
+#include "common/crypto.hpp"
+#include "common/data_writer.hpp"
+#include "common/utf8.hpp"
 
 using quiz::Message;
 using quiz::MessageType;
@@ -54,6 +62,70 @@ int main() {
     tr.expect(decoded.action == msg.action, "action preserved");
     tr.expect(decoded.type == msg.type, "message_type preserved");
     tr.expect(decoded.data == msg.data, "data preserved");
+    tr.expect(decoded.action.id() == quiz::ActionId::Login, "known action interned");
+  }
+
+  // Actions outside the protocol list keep their name through the codec.
+  {
+    Message msg;
+    msg.type = MessageType::Request;
+    msg.action = "PLUGIN_PING";
+    msg.timestamp = 1700000001;
+    tr.expect(!msg.action.known() && msg.action.str() == "PLUGIN_PING", "unknown action kept");
+
+    std::string err;
+    auto frame = quiz::encode_frame(msg, err);
+    Message decoded;
+    bool ok = quiz::decode_frame(frame, decoded, err);
+    tr.expect(ok && decoded.action == msg.action, "unknown action preserved");
+    tr.expect(decoded.action != quiz::Action(quiz::ActionId::Echo), "unknown differs from known");
+    tr.expect(quiz::action_from_string("SUBMIT_EXAM") == quiz::ActionId::SubmitExam &&
+                  quiz::to_string(quiz::ActionId::SubmitExam) == "SUBMIT_EXAM",
+              "action names round trip");
+  }
+
+  // Only an error response may come without an action (a shed request is
+  // refused before it is decrypted); anything else needs one.
+  {
+    Message msg;
+    msg.type = MessageType::Response;
+    msg.timestamp = 1700000002;
+    msg.status = Status::Error;
+    msg.error_code = "SERVER_BUSY";
+
+    std::string err;
+    Message decoded;
+    bool ok = quiz::decode_frame(quiz::encode_frame(msg, err), decoded, err);
+    tr.expect(ok && decoded.action.empty() && decoded.error_code == "SERVER_BUSY",
+              "error response without action");
+    msg.status = Status::Success;
+    ok = quiz::decode_frame(quiz::encode_frame(msg, err), decoded, err);
+    tr.expect(!ok, "success response needs an action");
+    msg.type = MessageType::Request;
+    msg.status = Status::None;
+    ok = quiz::decode_frame(quiz::encode_frame(msg, err), decoded, err);
+    tr.expect(!ok, "request needs an action");
+  }
+
+  // Optional deadline survives the round trip and defaults to none.
+  {
+    Message msg;
+    msg.type = MessageType::Request;
+    msg.action = "GET_ROOM_RESULTS";
+    msg.timestamp = 1700000003;
+    msg.deadline_ms = 2500;
+
+    std::string err;
+    auto frame = quiz::encode_frame(msg, err);
+    Message decoded;
+    bool ok = quiz::decode_frame(frame, decoded, err);
+    tr.expect(ok, "decode message with deadline");
+    tr.expect(decoded.deadline_ms == 2500, "deadline_ms preserved");
+
+    msg.deadline_ms = 0;
+    frame = quiz::encode_frame(msg, err);
+    ok = quiz::decode_frame(frame, decoded, err);
+    tr.expect(ok && decoded.deadline_ms == 0, "missing deadline_ms means no deadline");
   }
 
   // Large payload near limit.
@@ -113,5 +185,612 @@ int main() {
     tr.expect(!ok, "detect length mismatch");
   }
 
+  // v2 header is readable before decryption and survives the round trip;
+  // v1 frames still decode and report version 1.
+  {
+    Message msg;
+    msg.type = MessageType::Request;
+    msg.action = "SUBMIT_ANSWER";
+    msg.timestamp = 1700000004;
+
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    header.priority = quiz::Priority::High;
+    header.request_id = 0xA1B2C3D4;
+
+    std::string err;
+    auto frame = quiz::encode_frame(msg, header, err);
+    tr.expect(!frame.empty(), "encode v2 frame");
+
+    quiz::FrameHeader peeked;
+    bool ok = quiz::peek_frame_header(frame.data(), frame.size(), peeked, err);
+    tr.expect(ok && peeked.version == quiz::kProtocolV2, "peek v2 version");
+    tr.expect(peeked.priority == quiz::Priority::High, "peek v2 priority");
+    tr.expect(peeked.request_id == 0xA1B2C3D4, "peek v2 request_id");
+
+    Message decoded;
+    quiz::FrameHeader got;
+    ok = quiz::decode_frame(frame, decoded, got, err);
+    tr.expect(ok && decoded.action == msg.action, "decode v2 frame");
+    tr.expect(got.request_id == header.request_id, "v2 request_id preserved");
+
+    frame[4 + 2] = 9;  // unknown version
+    ok = quiz::decode_frame(frame, decoded, got, err);
+    tr.expect(!ok, "reject unsupported v2 version");
+
+    auto v1 = quiz::encode_frame(msg, err);
+    ok = quiz::decode_frame(v1, decoded, got, err);
+    tr.expect(ok && got.version == quiz::kProtocolV1, "v1 frame reports version 1");
+  }
+
+  // Chunk frames carry their sequence number and end-of-stream marker in
+  // the plaintext header; replies are never part of the request's stream.
+  {
+    Message msg;
+    msg.action = "IMPORT_QUESTIONS";
+    msg.timestamp = 1700000005;
+
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    header.flags = quiz::kFrameFlagChunk | quiz::kFrameFlagEndOfStream;
+    header.sequence = 0x1234;
+    header.request_id = 77;
+
+    std::string err;
+    auto frame = quiz::encode_frame(msg, header, err);
+    quiz::FrameHeader peeked;
+    bool ok = quiz::peek_frame_header(frame.data(), frame.size(), peeked, err);
+    tr.expect(ok && peeked.sequence == 0x1234 && peeked.request_id == 77, "chunk sequence read");
+    tr.expect(peeked.flags == (quiz::kFrameFlagChunk | quiz::kFrameFlagEndOfStream),
+              "chunk flags read");
+
+    auto reply = quiz::reply_header(peeked);
+    tr.expect(reply.flags == 0 && reply.sequence == 0 && reply.request_id == 77,
+              "reply leaves the stream");
+
+    frame[4 + 3] = quiz::kFrameFlagEndOfStream;
+    ok = quiz::peek_frame_header(frame.data(), frame.size(), peeked, err);
+    tr.expect(!ok, "end of stream without chunk rejected");
+  }
+
+  // GCM keys agreed through a key exchange match on both ends. Frames
+  // round-trip at every envelope length and in every encoding, keep the v2
+  // length rule, carry their sequence number as the nonce, and fail when the
+  // ciphertext or the plaintext header is touched, when replayed, or when
+  // opened with another connection's keys.
+  {
+    quiz::KeyExchange client_kx;
+    quiz::KeyExchange server_kx;
+    quiz::GcmKeys client_keys;
+    quiz::GcmKeys server_keys;
+    std::string err;
+    bool ok = client_kx.ok() && server_kx.ok() &&
+              client_kx.derive(server_kx.public_key_hex(), true, client_keys, err) &&
+              server_kx.derive(client_kx.public_key_hex(), false, server_keys, err);
+    tr.expect(ok && std::equal(client_keys.send, client_keys.send + quiz::kGcmKeyBytes,
+                               server_keys.recv) &&
+                  std::equal(client_keys.recv, client_keys.recv + quiz::kGcmKeyBytes,
+                             server_keys.send) &&
+                  !std::equal(client_keys.send, client_keys.send + quiz::kGcmKeyBytes,
+                              client_keys.recv),
+              "key exchange agrees on one key per direction");
+    tr.expect(!client_kx.derive(std::string(64, 'z'), true, client_keys, err),
+              "malformed key share refused");
+
+    Message msg;
+    msg.type = MessageType::Request;
+    msg.action = "SUBMIT_ANSWER";
+    msg.timestamp = 1700000006;
+
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    header.flags = quiz::kFrameFlagGcm;
+    header.request_id = 9;
+
+    std::uint64_t sequence = 0;
+    bool all_ok = true;
+    for (std::size_t extra = 0; extra < 32; ++extra) {
+      msg.data = {{"pad", std::string(extra, 'x')}};
+      for (auto encoding : {quiz::Encoding::Json, quiz::Encoding::MsgPack, quiz::Encoding::Cbor}) {
+        header.encoding = encoding;
+        ++sequence;
+        const quiz::GcmFrameKey seal{client_keys.send, sequence};
+        const quiz::GcmFrameKey open{server_keys.recv, sequence};
+        std::vector<std::uint8_t> frame;
+        Message decoded;
+        quiz::FrameHeader got;
+        all_ok = all_ok && quiz::encode_frame_into(msg, header, frame, err, &seal) &&
+                 (frame.size() - 4) % 16 == 12 &&
+                 quiz::decode_frame(frame, decoded, got, err, &open) &&
+                 decoded.data == msg.data && (got.flags & quiz::kFrameFlagGcm);
+      }
+    }
+    tr.expect(all_ok, "GCM round trip keeps the v2 length rule");
+
+    header.encoding = quiz::Encoding::Json;
+    header.flags = quiz::kFrameFlagGcm | quiz::kFrameFlagDeflate;
+    msg.data = {{"pad", std::string(4000, 'q')}};
+    const quiz::GcmFrameKey first{server_keys.send, 1};
+    const quiz::GcmFrameKey first_in{client_keys.recv, 1};
+    std::vector<std::uint8_t> frame;
+    Message decoded;
+    quiz::FrameHeader got;
+    ok = quiz::encode_frame_into(msg, header, frame, err, &first) &&
+         quiz::decode_frame(frame, decoded, got, err, &first_in);
+    tr.expect(ok && (got.flags & quiz::kFrameFlagDeflate) && decoded.data == msg.data,
+              "GCM with deflate round trip");
+
+    header.flags = quiz::kFrameFlagGcm;
+    msg.data = {{"n", 1}};
+    tr.expect(quiz::encode_frame(msg, header, err).empty() &&
+                  err.find("without a connection key") != std::string::npos,
+              "GCM needs a connection key");
+    std::vector<std::uint8_t> a;
+    std::vector<std::uint8_t> b;
+    const quiz::GcmFrameKey second{server_keys.send, 2};
+    quiz::encode_frame_into(msg, header, a, err, &first);
+    quiz::encode_frame_into(msg, header, b, err, &second);
+    const std::size_t nonce = 4 + quiz::kFrameHeaderBytes;
+    const std::size_t low = nonce + quiz::kGcmNonceBytes - 1;
+    tr.expect(a[low] == 1 && b[low] == 2 &&
+                  !std::equal(a.begin() + nonce, a.end(), b.begin() + nonce),
+              "nonce is the frame's sequence number");
+    tr.expect(quiz::reply_header(header).flags == quiz::kFrameFlagGcm, "reply keeps GCM");
+
+    ok = quiz::decode_frame(a, decoded, got, err, &first_in);
+    const quiz::GcmFrameKey second_in{client_keys.recv, 2};
+    const bool replay = quiz::decode_frame(a, decoded, got, err, &second_in);
+    tr.expect(ok && !replay && err.find("unexpected sequence") != std::string::npos,
+              "replayed frame rejected");
+    const quiz::GcmFrameKey wrong_key{server_keys.recv, 1};
+    ok = quiz::decode_frame(a, decoded, got, err, &wrong_key);
+    tr.expect(!ok && err.find("authentication failed") != std::string::npos,
+              "another connection's key fails the tag check");
+    ok = quiz::decode_frame(a, decoded, got, err);
+    tr.expect(!ok, "GCM frame without a key rejected");
+
+    auto tampered = a;
+    tampered[nonce + quiz::kGcmNonceBytes] ^= 0x01;
+    ok = quiz::decode_frame(tampered, decoded, got, err, &first_in);
+    tr.expect(!ok && err.find("authentication failed") != std::string::npos,
+              "tampered ciphertext fails the tag check");
+    tampered = a;
+    tampered[4 + 5] = static_cast<std::uint8_t>(quiz::Priority::High);
+    ok = quiz::decode_frame(tampered, decoded, got, err, &first_in);
+    tr.expect(!ok && err.find("authentication failed") != std::string::npos,
+              "tampered header fails the tag check");
+  }
+
+  // Plaintext frames (for kernel TLS connections) keep the v2 length rule
+  // too, are answered in kind, and cannot also claim GCM.
+  {
+    Message msg;
+    msg.action = "ECHO";
+    msg.timestamp = 1700000007;
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    header.flags = quiz::kFrameFlagPlaintext;
+
+    std::string err;
+    bool all_ok = true;
+    for (std::size_t extra = 0; extra < 32; ++extra) {
+      msg.data = {{"pad", std::string(extra, 'x')}};
+      auto frame = quiz::encode_frame(msg, header, err);
+      Message decoded;
+      quiz::FrameHeader got;
+      all_ok = all_ok && !frame.empty() && (frame.size() - 4) % 16 == 12 &&
+               quiz::decode_frame(frame, decoded, got, err) && decoded.data == msg.data;
+    }
+    tr.expect(all_ok, "plaintext round trip keeps the v2 length rule");
+    tr.expect(quiz::reply_header(header).flags == quiz::kFrameFlagPlaintext,
+              "reply stays plaintext");
+
+    header.flags |= quiz::kFrameFlagGcm;
+    tr.expect(quiz::encode_frame(msg, header, err).empty(), "GCM plus plaintext refused");
+  }
+
+  // Binary encodings round-trip, beat JSON on numeric-heavy data, and are
+  // held to the same UTF-8 rules as JSON text.
+  {
+    Message msg;
+    msg.type = MessageType::Response;
+    msg.action = "GET_EXAM_PAPER";
+    msg.timestamp = 1700000005;
+    msg.status = Status::Success;
+    nlohmann::json questions = nlohmann::json::array();
+    for (int i = 0; i < 50; ++i) {
+      questions.push_back({{"question_id", 100000 + i},
+                           {"content", "Câu hỏi " + std::to_string(i)},
+                           {"options", {{"A", "1"}, {"B", "2"}, {"C", "3"}, {"D", "4"}}}});
+    }
+    msg.data = {{"exam_id", 42}, {"questions", questions}};
+
+    std::string err;
+    auto json_frame = quiz::encode_frame(msg, err);
+    for (auto encoding : {quiz::Encoding::MsgPack, quiz::Encoding::Cbor}) {
+      const std::string name = quiz::to_string(encoding);
+      quiz::FrameHeader header;
+      header.version = quiz::kProtocolV2;
+      header.encoding = encoding;
+      auto frame = quiz::encode_frame(msg, header, err);
+      tr.expect(!frame.empty(), "encode " + name + " frame");
+      tr.expect(frame.size() < json_frame.size(), name + " smaller than JSON");
+
+      Message decoded;
+      quiz::FrameHeader got;
+      bool ok = quiz::decode_frame(frame, decoded, got, err);
+      tr.expect(ok && got.encoding == encoding, "decode " + name + " frame");
+      tr.expect(decoded.data == msg.data && decoded.status == msg.status,
+                name + " envelope preserved");
+    }
+
+    // Hand-built MessagePack envelope with an invalid string.
+    nlohmann::json bad = quiz::message_to_json(msg);
+    bad["data"] = {{"name", std::string("\xC3\x28")}};
+    auto packed = nlohmann::json::to_msgpack(bad);
+    auto cipher = quiz::encrypt_aes_cbc(packed.data(), packed.size(), err);
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    header.encoding = quiz::Encoding::MsgPack;
+    auto frame = quiz::encode_frame(msg, header, err);
+    frame.resize(quiz::kFramePrefixBytes + quiz::kFrameHeaderBytes);
+    frame.insert(frame.end(), cipher.begin(), cipher.end());
+    std::uint32_t len = static_cast<std::uint32_t>(quiz::kFrameHeaderBytes + cipher.size());
+    frame[0] = static_cast<std::uint8_t>(len >> 24);
+    frame[1] = static_cast<std::uint8_t>(len >> 16);
+    frame[2] = static_cast<std::uint8_t>(len >> 8);
+    frame[3] = static_cast<std::uint8_t>(len);
+    Message decoded;
+    tr.expect(!quiz::decode_frame(frame, decoded, err), "reject invalid UTF-8 in MSGPACK");
+
+    Message invalid = msg;
+    invalid.data = {{"name", std::string("\xC3\x28")}};
+    tr.expect(quiz::encode_frame(invalid, header, err).empty(),
+              "refuse to encode invalid UTF-8 as MSGPACK");
+  }
+
+  // The in-place encoder produces exactly the frame the DOM would
+  // serialize to, in every encoding, and reuses the caller's buffer.
+  {
+    Message msg;
+    msg.type = MessageType::Response;
+    msg.action = "GET_ROOM_RESULTS";
+    msg.timestamp = 1700000000123ull;
+    msg.session_id = "s-1";
+    msg.deadline_ms = 70000;
+    msg.status = Status::Error;
+    msg.error_code = "E\"1\\";
+    msg.error_message = std::string("tab\tnl\nctl\x01 ") + "\xC4\x91\xC3\xA1p \xC3\xA1n";
+    msg.data = {{"scores", {1, 300, 70000, 5000000000ull, -2, 1.5}},
+                {"name", std::string(40, 'x')},
+                {"long", std::string(300, 'y')},
+                {"nested", {{"ok", true}, {"none", nullptr}}}};
+
+    for (auto encoding : {quiz::Encoding::Json, quiz::Encoding::MsgPack, quiz::Encoding::Cbor}) {
+      quiz::FrameHeader header;
+      header.version = quiz::kProtocolV2;
+      header.encoding = encoding;
+      std::string err;
+      std::vector<std::uint8_t> frame;
+      bool ok = quiz::encode_frame_into(msg, header, frame, err);
+      auto dom = quiz::message_to_json(msg);
+      std::vector<std::uint8_t> plain;
+      if (encoding == quiz::Encoding::Json) {
+        auto text = dom.dump();
+        plain.assign(text.begin(), text.end());
+      } else {
+        plain = encoding == quiz::Encoding::MsgPack ? nlohmann::json::to_msgpack(dom)
+                                                    : nlohmann::json::to_cbor(dom);
+      }
+      auto cipher = quiz::encrypt_aes_cbc(plain.data(), plain.size(), err);
+      const std::size_t body = quiz::kFramePrefixBytes + quiz::kFrameHeaderBytes;
+      tr.expect(ok && frame.size() == body + cipher.size() &&
+                    std::equal(cipher.begin(), cipher.end(), frame.begin() + body),
+                "in-place encode matches DOM serialization (" + quiz::to_string(encoding) + ")");
+
+      const auto* before = frame.data();
+      ok = quiz::encode_frame_into(msg, header, frame, err);
+      tr.expect(ok && frame.data() == before, "encode buffer reused");
+    }
+  }
+
+  // The in-place and buffer-reusing AES forms agree with the allocating
+  // ones, and a failed decrypt leaves the thread's context usable.
+  {
+    std::string err;
+    const std::string text = "per-thread AES contexts are reset, not recreated";
+    const auto* bytes = reinterpret_cast<const std::uint8_t*>(text.data());
+    const auto cipher = quiz::encrypt_aes_cbc(bytes, text.size(), err);
+
+    std::vector<std::uint8_t> buffer = {0xAA, 0xBB};
+    buffer.insert(buffer.end(), bytes, bytes + text.size());
+    bool ok = quiz::encrypt_aes_cbc_in_place(buffer, 2, err);
+    tr.expect(ok && buffer.size() == 2 + cipher.size() &&
+                  std::equal(cipher.begin(), cipher.end(), buffer.begin() + 2),
+              "in-place encrypt matches encrypt_aes_cbc");
+    ok = quiz::decrypt_aes_cbc_in_place(buffer, 2, err);
+    tr.expect(ok && std::string(buffer.begin() + 2, buffer.end()) == text && buffer[0] == 0xAA,
+              "in-place decrypt restores plaintext after offset");
+
+    auto corrupt = cipher;
+    corrupt.back() ^= 0x01;
+    std::vector<std::uint8_t> out;
+    tr.expect(!quiz::decrypt_aes_cbc_into(corrupt.data(), corrupt.size(), out, err),
+              "corrupted padding rejected");
+    ok = quiz::decrypt_aes_cbc_into(cipher.data(), cipher.size(), out, err);
+    tr.expect(ok && std::string(out.begin(), out.end()) == text,
+              "decrypt after a failure succeeds");
+  }
+
+  // Password hashes are salted per call, verify only the right password,
+  // and legacy hashes still verify while asking to be upgraded.
+  {
+    const std::string first = quiz::hash_password("teacher123");
+    const std::string second = quiz::hash_password("teacher123");
+    tr.expect(first.rfind("$scrypt$", 0) == 0 && first != second, "scrypt hash with fresh salt");
+    bool rehash = true;
+    tr.expect(quiz::verify_password("teacher123", first, &rehash) && !rehash,
+              "current hash verifies without rehash");
+    tr.expect(!quiz::verify_password("teacher124", first), "wrong password rejected");
+
+    std::ostringstream legacy;
+    legacy << std::hex << std::hash<std::string>{}("quiz_salt" + std::string("teacher123"));
+    tr.expect(quiz::verify_password("teacher123", legacy.str(), &rehash) && rehash,
+              "legacy hash verifies and asks for rehash");
+    tr.expect(!quiz::verify_password("nope", legacy.str(), &rehash) && !rehash,
+              "legacy hash rejects wrong password");
+
+    tr.expect(!quiz::verify_password("teacher123", first + "$"), "trailing field rejected");
+    tr.expect(!quiz::verify_password("teacher123", "$scrypt$40$8$1$00$00"),
+              "out-of-range cost rejected");
+    tr.expect(!quiz::verify_password("teacher123", ""), "empty hash rejected");
+  }
+
+  // DataWriter output is what the equivalent DOM serializes to, so a reply
+  // streamed through write_data decodes like one built as JSON.
+  {
+    const nlohmann::json dom = {
+        {"rows", {{{"id", 1}, {"name", "a\"b"}, {"score", 2.5}}, {{"id", -7}, {"name", ""}, {"score", 0.0}}}},
+        {"settings", {{"topics", nlohmann::json::array()}}},
+        {"total", 5000000000ull},
+        {"void", nullptr},
+        {"yes", true}};
+    auto write = [](quiz::DataWriter& w) {
+      w.begin_object(5);
+      w.key("rows");
+      w.begin_array(2);
+      for (int i = 0; i < 2; ++i) {
+        w.begin_object(3);
+        w.key("id");
+        w.integer(i == 0 ? 1 : -7);
+        w.key("name");
+        w.string(i == 0 ? "a\"b" : "");
+        w.key("score");
+        w.real(i == 0 ? 2.5 : 0.0);
+        w.end_object();
+      }
+      w.end_array();
+      w.key("settings");
+      w.raw_json(R"({"topics":[]})");
+      w.key("total");
+      w.number(5000000000ull);
+      w.key("void");
+      w.null();
+      w.key("yes");
+      w.boolean(true);
+      w.end_object();
+    };
+    for (auto encoding : {quiz::Encoding::Json, quiz::Encoding::MsgPack, quiz::Encoding::Cbor}) {
+      std::vector<std::uint8_t> out;
+      quiz::DataWriter w(out, encoding);
+      write(w);
+      std::vector<std::uint8_t> expected;
+      if (encoding == quiz::Encoding::Json) {
+        auto text = dom.dump();
+        expected.assign(text.begin(), text.end());
+      } else {
+        expected = encoding == quiz::Encoding::MsgPack ? nlohmann::json::to_msgpack(dom)
+                                                       : nlohmann::json::to_cbor(dom);
+      }
+      tr.expect(w.ok() && out == expected,
+                "data writer matches DOM serialization (" + quiz::to_string(encoding) + ")");
+
+      Message msg;
+      msg.type = MessageType::Response;
+      msg.action = "GET_USER_HISTORY";
+      msg.timestamp = 1700000010;
+      msg.status = Status::Success;
+      msg.write_data = write;
+      quiz::FrameHeader header;
+      header.version = quiz::kProtocolV2;
+      header.encoding = encoding;
+      std::string err;
+      auto frame = quiz::encode_frame(msg, header, err);
+      Message decoded;
+      bool ok = quiz::decode_frame(frame, decoded, err);
+      tr.expect(ok && decoded.data == dom, "write_data reply decodes to its data");
+    }
+
+    std::vector<std::uint8_t> out;
+    quiz::DataWriter w(out, quiz::Encoding::MsgPack);
+    w.begin_object(1);
+    w.key("name");
+    w.string("\xC3\x28");
+    w.end_object();
+    tr.expect(!w.ok(), "data writer rejects invalid UTF-8");
+  }
+
+  // Deflate applies to large v2 envelopes only and is flagged per frame.
+  {
+    Message msg;
+    msg.type = MessageType::Response;
+    msg.action = "GET_ROOM_DETAILS";
+    msg.timestamp = 1700000007;
+    msg.status = Status::Success;
+    nlohmann::json participants = nlohmann::json::array();
+    for (int i = 0; i < 40; ++i) {
+      participants.push_back({{"user_id", i}, {"username", "student" + std::to_string(i)},
+                              {"full_name", "Student " + std::to_string(i)},
+                              {"status", "READY"}, {"joined_at", 1700000000 + i}});
+    }
+    msg.data = {{"room_id", 3}, {"participants", participants}};
+
+    quiz::FrameHeader header;
+    header.version = quiz::kProtocolV2;
+    std::string err;
+    auto plain_frame = quiz::encode_frame(msg, header, err);
+    header.flags = quiz::kFrameFlagDeflate;
+    auto frame = quiz::encode_frame(msg, header, err);
+    quiz::FrameHeader got;
+    bool ok = quiz::peek_frame_header(frame.data(), frame.size(), got, err);
+    tr.expect(ok && (got.flags & quiz::kFrameFlagDeflate), "large frame deflated");
+    tr.expect(frame.size() * 3 < plain_frame.size(), "deflate shrinks repetitive payload");
+    Message decoded;
+    ok = quiz::decode_frame(frame, decoded, got, err);
+    tr.expect(ok && decoded.data == msg.data, "deflated frame round trip");
+
+    Message small;
+    small.action = "PING";
+    small.timestamp = 1;
+    auto small_frame = quiz::encode_frame(small, header, err);
+    ok = quiz::peek_frame_header(small_frame.data(), small_frame.size(), got, err);
+    tr.expect(ok && got.flags == 0, "small frame sent uncompressed");
+
+    quiz::FrameHeader request;
+    request.version = quiz::kProtocolV2;
+    request.flags = quiz::kFrameFlagAcceptDeflate;
+    tr.expect(quiz::reply_header(request).flags == quiz::kFrameFlagDeflate,
+              "reply deflated when accepted");
+    tr.expect(quiz::reply_header(quiz::FrameHeader{}).flags == 0, "reply plain by default");
+
+    std::string text = msg.data.dump();
+    std::vector<std::uint8_t> packed;
+    std::vector<std::uint8_t> unpacked;
+    ok = quiz::deflate_payload(reinterpret_cast<const std::uint8_t*>(text.data()), text.size(),
+                               packed, err);
+    tr.expect(ok && !quiz::inflate_payload(packed.data(), packed.size(), text.size() - 1,
+                                           unpacked, err),
+              "inflate stops at the size limit");
+    tr.expect(!quiz::inflate_payload(packed.data(), packed.size() / 2, text.size(), unpacked,
+                                     err),
+              "truncated deflate stream rejected");
+  }
+
+  // Envelope-only decoding reads the top-level fields and leaves data as
+  // text until it is materialized.
+  {
+    Message msg;
+    msg.type = MessageType::Request;
+    msg.action = "SUBMIT_ANSWER";
+    msg.timestamp = 1700000006;
+    msg.session_id = "abc";
+    msg.deadline_ms = 250;
+    msg.data = {{"exam_id", 7}, {"note", "brace } and \"quote\" [inside]"},
+                {"answers", {{{"question_id", 1}, {"choice", "A"}}}}};
+
+    std::string err;
+    auto frame = quiz::encode_frame(msg, err);
+    Message decoded;
+    quiz::FrameHeader header;
+    bool ok = quiz::decode_frame_envelope(frame, decoded, header, err);
+    tr.expect(ok, "decode envelope");
+    tr.expect(decoded.action == msg.action && decoded.session_id == msg.session_id &&
+                  decoded.timestamp == msg.timestamp && decoded.deadline_ms == 250,
+              "envelope fields preserved");
+    tr.expect(!decoded.raw_data.empty() && decoded.data.empty(), "data left unparsed");
+    ok = quiz::materialize_data(decoded, err);
+    tr.expect(ok && decoded.data == msg.data && decoded.raw_data.empty(),
+              "materialized data matches");
+
+    // Same checks as a full decode for the envelope itself.
+    auto encrypt_json = [&](const std::string& text) {
+      auto cipher = quiz::encrypt_aes_cbc(reinterpret_cast<const std::uint8_t*>(text.data()),
+                                          text.size(), err);
+      std::vector<std::uint8_t> out(quiz::kFramePrefixBytes);
+      std::uint32_t len = static_cast<std::uint32_t>(cipher.size());
+      out[0] = static_cast<std::uint8_t>(len >> 24);
+      out[1] = static_cast<std::uint8_t>(len >> 16);
+      out[2] = static_cast<std::uint8_t>(len >> 8);
+      out[3] = static_cast<std::uint8_t>(len);
+      out.insert(out.end(), cipher.begin(), cipher.end());
+      return out;
+    };
+    ok = quiz::decode_frame_envelope(
+        encrypt_json(R"({"message_type":"REQUEST","timestamp":1,"data":{}})"), decoded, header,
+        err);
+    tr.expect(!ok, "envelope without action rejected");
+    ok = quiz::decode_frame_envelope(
+        encrypt_json(R"({"message_type":"REQUEST","action":"X","timestamp":1,"data":[]})"),
+        decoded, header, err);
+    tr.expect(!ok, "envelope with non-object data rejected");
+    ok = quiz::decode_frame_envelope(
+        encrypt_json(R"({"message_type":"REQUEST","action":"X","timestamp":1} trailing)"),
+        decoded, header, err);
+    tr.expect(!ok, "envelope with trailing garbage rejected");
+    ok = quiz::decode_frame_envelope(
+        encrypt_json(R"({"message_type":"REQUEST","act\u0069on":"X","timestamp":1})"),
+        decoded, header, err);
+    tr.expect(ok && decoded.action == "X", "escaped key falls back to full parse");
+
+    // Broken data only surfaces when someone needs it.
+    ok = quiz::decode_frame_envelope(
+        encrypt_json(R"({"message_type":"REQUEST","action":"X","timestamp":1,"data":{"a":]})"),
+        decoded, header, err);
+    tr.expect(ok, "envelope decode ignores data syntax");
+    tr.expect(!quiz::materialize_data(decoded, err), "materialize rejects broken data");
+  }
+
+  // Every UTF-8 kernel enforces RFC 3629 and agrees with the scalar one,
+  // wherever in a vector block the offending sequence lands.
+  {
+    const std::vector<std::pair<std::string, bool>> cases = {
+        {"plain ascii", true},
+        {"\xC3\xA2u h\xE1\xBB\x8Fi", true},            // 2- and 3-byte forms
+        {"\xF0\x9F\x98\x80", true},                      // U+1F600
+        {"\xF4\x8F\xBF\xBF", true},                      // U+10FFFF
+        {"\xED\x9F\xBF", true},                           // U+D7FF
+        {"\xC0\x80", false},                               // overlong NUL
+        {"\xC1\xBF", false},                               // overlong 2-byte
+        {"\xE0\x80\x80", false},                          // overlong 3-byte
+        {"\xF0\x80\x80\x80", false},                     // overlong 4-byte
+        {"\xED\xA0\x80", false},                          // surrogate U+D800
+        {"\xED\xBF\xBF", false},                          // surrogate U+DFFF
+        {"\xF4\x90\x80\x80", false},                     // U+110000
+        {"\xF5\x80\x80\x80", false},                     // invalid lead
+        {"\x80", false},                                    // stray continuation
+        {"\xE2\x82", false},                               // truncated
+        {"\xC3\x28", false},                               // missing continuation
+        {"\xE2\x82\xAC\xAC", false},                     // extra continuation
+    };
+    for (auto impl : {quiz::Utf8Impl::Scalar, quiz::Utf8Impl::Sse4, quiz::Utf8Impl::Avx2}) {
+      if (!quiz::utf8_impl_available(impl)) continue;
+      const std::string name = quiz::to_string(impl);
+      for (const auto& [text, valid] : cases) {
+        for (std::size_t offset : {0, 13, 14, 15, 30, 31, 62, 63}) {
+          std::string s = std::string(offset, 'a') + text + std::string(offset % 7, 'b');
+          tr.expect(quiz::is_valid_utf8_with(impl, s.data(), s.size()) == valid,
+                    name + " utf8 case at offset " + std::to_string(offset));
+        }
+      }
+
+      std::mt19937 rng(1234);
+      const std::string alphabet[] = {"a", "\xC3\xA9", "\xE1\xBB\x8F", "\xF0\x9F\x98\x80",
+                                      "\x80", "\xED\xA0", "\xF4\x90", "\xC0"};
+      for (int round = 0; round < 2000; ++round) {
+        std::string s;
+        const int pieces = static_cast<int>(rng() % 40);
+        for (int i = 0; i < pieces; ++i) {
+          // Mostly valid pieces, so some strings stay valid end to end.
+          s += alphabet[rng() % 16 < 15 ? rng() % 4 : 4 + rng() % 4];
+        }
+        bool expected = quiz::is_valid_utf8_with(quiz::Utf8Impl::Scalar, s.data(), s.size());
+        if (quiz::is_valid_utf8_with(impl, s.data(), s.size()) != expected) {
+          tr.expect(false, name + " utf8 disagrees with scalar in round " + std::to_string(round));
+          break;
+        }
+      }
+    }
+  }
+
   return tr.exit_code();
 }